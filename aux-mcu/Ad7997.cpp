@@ -13,42 +13,130 @@
 
 CAd7997::CAd7997(const uint8_t i2cAddr) :
   m_i2cAddr(i2cAddr),
-  m_inBytes{ 0 },
-  m_errCnt(0)
+  m_inBytes{ { 0 } },
+  m_inMask{ 0, 0 },
+  m_inSlot(0),
+  m_config(E_CONFIG_FLTR),
+  m_seqMask(0),
+  m_values{ 0 },
+  m_errCnt(0),
+  m_alertStatus(0)
 {
+  setupXfer(E_XFER_CONFIG, ECREG_CONFIG, NULL, 0);
+  m_xfer[E_XFER_CONFIG].data_wr = m_configBuf;
+  m_xfer[E_XFER_CONFIG].bytes_wr = sizeof(m_configBuf);
+  setupXfer(E_XFER_SEQUENCE, E_READ_SEQ_CMD, m_inBytes[1], sizeof(m_inBytes[1]));
+  setupXfer(E_XFER_SINGLE, E_READ_CMD, m_inBytes[0], sizeof(m_inBytes[0][0]) * 2);
 }
 
 CAd7997::~CAd7997(void)
 {
 }
 
-void CAd7997::begin(void)
+void CAd7997::setupXfer(uint8_t slot, uint8_t cmd, uint8_t *data_rd, uint8_t bytes_rd)
 {
-  // Setup the port configuration.
-  uint8_t data[] = { ECREG_ADDR, ECREG_MSB, ECREG_LSB };
-  twi_initiate_write(m_i2cAddr, data, sizeof(data));
+  m_cmd[slot] = cmd;
+  m_xfer[slot].address = m_i2cAddr;
+  m_xfer[slot].data_wr = &m_cmd[slot];
+  m_xfer[slot].bytes_wr = sizeof(m_cmd[slot]);
+  m_xfer[slot].data_rd = data_rd;
+  m_xfer[slot].bytes_rd = bytes_rd;
+  m_xfer[slot].complete_callback = NULL;
+  m_xfer[slot].status = TWI_XFER_DONE;
+}
+
+void CAd7997::queueConfig(void)
+{
+  uint16_t config = m_config | ((uint16_t)m_seqMask << E_CONFIG_CH_SHIFT);
+  m_configBuf[0] = ECREG_CONFIG;
+  m_configBuf[1] = config >> 8;
+  m_configBuf[2] = config;
+  twi_queue_transaction(&m_xfer[E_XFER_CONFIG]);
+}
+
+void CAd7997::begin(bool alertMode)
+{
+  // Select all channels for the conversion sequence.
+  m_config = E_CONFIG_FLTR;
+  m_seqMask = E_ALL_CHANNELS;
+  if (alertMode) {
+    m_config |= E_CONFIG_ALERT_EN;
+    for (uint8_t i = 0; i < E_NUM_LIMIT_PORTS; i++) {
+      uint8_t hyst[] = { (uint8_t)(ECREG_HYSTERESIS + (i * E_LIMIT_REG_STRIDE)), 0, 0 };
+      twi_initiate_write(m_i2cAddr, hyst, sizeof(hyst));
+      setWindow(i, 0, E_MAX_VALUE);
+    }
+    twi_wait_until_master_ready();
+    syncAlerts();
+  }
+  queueConfig();
+
+  // Conversions only happen when we ask for them.
+  uint8_t cycle[] = { ECREG_CYCLE_TIMER, E_CYCLE_TIMER_OFF };
+  twi_initiate_write(m_i2cAddr, cycle, sizeof(cycle));
   twi_wait_until_master_ready();
 
   // Sync with the hardware
   sync();
 }
 
-void CAd7997::start(void)
+void CAd7997::startSequence(uint8_t mask)
 {
-  uint8_t data_wr[] = { E_READ_ALL_CMD };
-  twi_initiate_transaction(m_i2cAddr, data_wr, sizeof(data_wr), m_inBytes, sizeof(m_inBytes));
+  if (mask != m_seqMask) {
+    m_seqMask = mask;
+    queueConfig();
+  }
+
+  // The results come back in channel order, each tagged with its channel ID
+  // (latch() spreads them out, read() checks the IDs).
+  uint8_t count = 0;
+  for (uint8_t m = mask; m; m >>= 1)
+    count += m & 1;
+  uint8_t back = m_inSlot ^ 1;
+  m_inMask[back] = mask;
+  m_xfer[E_XFER_SEQUENCE].data_rd = m_inBytes[back];
+  m_xfer[E_XFER_SEQUENCE].bytes_rd = count * 2;
+  twi_queue_transaction(&m_xfer[E_XFER_SEQUENCE]);
 }
 
 void CAd7997::sync(void)
 {
   start();
   twi_wait_until_master_ready();
+  latch();
+}
+
+bool CAd7997::latch(void)
+{
+  // A failed sequence keeps the previous results.
+  if (m_xfer[E_XFER_SEQUENCE].status != TWI_XFER_DONE)
+    return false;
+  m_inSlot ^= 1;
+
+  // Move the packed results to their channel positions, from the last one
+  // back so none is overwritten before it has been moved.
+  uint8_t *in = m_inBytes[m_inSlot];
+  uint8_t mask = m_inMask[m_inSlot];
+  if (mask == E_ALL_CHANNELS)
+    return true;
+  uint8_t k = 0;
+  for (uint8_t m = mask; m; m >>= 1)
+    k += m & 1;
+  for (int8_t i = E_NUM_PORTS - 1; i >= 0; i--) {
+    if ((mask >> i) & 1) {
+      k--;
+      in[2 * i] = in[2 * k];
+      in[(2 * i) + 1] = in[(2 * k) + 1];
+    }
+  }
+  return true;
 }
 
 void CAd7997::start(uint8_t i)
 {
-  uint8_t data_wr[] = { (uint8_t)(E_READ_CMD + (i << 4)) };
-  twi_initiate_transaction(m_i2cAddr, data_wr, sizeof(data_wr), m_inBytes + (2 * i), sizeof(m_inBytes[0]) * 2);
+  m_cmd[E_XFER_SINGLE] = E_READ_CMD + (i << 4);
+  m_xfer[E_XFER_SINGLE].data_rd = m_inBytes[m_inSlot] + (2 * i);
+  twi_queue_transaction(&m_xfer[E_XFER_SINGLE]);
 }
 
 void CAd7997::sync(uint8_t i)
@@ -57,3 +145,28 @@ void CAd7997::sync(uint8_t i)
   twi_wait_until_master_ready();
 }
 
+uint8_t CAd7997::syncAlerts(void)
+{
+  uint8_t cmd = ECREG_ALERT_STATUS;
+  twi_initiate_transaction(m_i2cAddr, &cmd, sizeof(cmd), &m_alertStatus, sizeof(m_alertStatus));
+  twi_wait_until_master_ready();
+
+  // Writing the flags back clears them.
+  uint8_t data[] = { ECREG_ALERT_STATUS, m_alertStatus };
+  twi_initiate_write(m_i2cAddr, data, sizeof(data));
+  twi_wait_until_master_ready();
+  return m_alertStatus;
+}
+
+void CAd7997::setWindow(uint8_t i, uint16_t low, uint16_t high)
+{
+  // Note: Each buffer is reused only after the bus went idle again.
+  m_limitBuf[0][0] = ECREG_DATA_LOW + (i * E_LIMIT_REG_STRIDE);
+  m_limitBuf[0][1] = low >> 8;
+  m_limitBuf[0][2] = low;
+  twi_initiate_write(m_i2cAddr, m_limitBuf[0], sizeof(m_limitBuf[0]));
+  m_limitBuf[1][0] = ECREG_DATA_HIGH + (i * E_LIMIT_REG_STRIDE);
+  m_limitBuf[1][1] = high >> 8;
+  m_limitBuf[1][2] = high;
+  twi_initiate_write(m_i2cAddr, m_limitBuf[1], sizeof(m_limitBuf[1]));
+}
@@ -19,38 +19,103 @@ class CAd7997
     enum properties
     {
       E_NUM_PORTS = 8,
+      E_NUM_LIMIT_PORTS = 4, // Only CH1 - CH4 have limit registers (and alerts).
+      E_MAX_VALUE = 4095,
+      E_ALL_CHANNELS = (1 << E_NUM_PORTS) - 1,
     };
     
   private:
     enum cmd_reg
     {
-      ECREG_ADDR = 2,
-      ECREG_MSB = 0x0f,
-      ECREG_LSB = 0xf8,
+      ECREG_ALERT_STATUS = 1,
+      ECREG_CONFIG = 2,
+      ECREG_CYCLE_TIMER = 3,
+      ECREG_DATA_LOW = 4,       // DATA_LOW, DATA_HIGH and hysteresis for CH1,
+      ECREG_DATA_HIGH = 5,      // then the same for CH2 - CH4.
+      ECREG_HYSTERESIS = 6,
+      E_LIMIT_REG_STRIDE = 3,
+      E_CONFIG_FLTR = 0x0008,   // SDA / SCL filtering on.
+      E_CONFIG_ALERT_EN = 0x0004, // ALERT pin and alert flags enabled.
+      E_RESULT_ALERT_FLAG = 0x80, // In the MSB of each conversion result.
+      E_CONFIG_CH_SHIFT = 4,    // CH1 - CH8 select bits are D4 - D11.
+      E_CYCLE_TIMER_OFF = 0x00, // No autonomous conversions (we trigger them).
       E_READ_CMD = 0x80,
-      E_READ_ALL_CMD = 0x70,
+      E_READ_SEQ_CMD = 0x70,    // Convert the channels selected in the config register.
+    };
+    enum xfer_slots
+    {
+      E_XFER_CONFIG,
+      E_XFER_SEQUENCE,
+      E_XFER_SINGLE,
+
+      E_NUM_XFERS
     };
     const uint8_t m_i2cAddr;
-    uint8_t m_inBytes[E_NUM_PORTS * 2];
+    // Double buffered - the sequence reads into the back slot while read()
+    // uses the front slot, until latch() swaps them.
+    uint8_t m_inBytes[2][E_NUM_PORTS * 2];
+    uint8_t m_inMask[2]; // Channels converted into each slot.
+    uint8_t m_inSlot;
+    uint16_t m_config;   // Config register, less the channel select bits.
+    uint8_t m_seqMask;   // Channel select bits last written.
+    uint8_t m_configBuf[3];
+    uint16_t m_values[E_NUM_PORTS];
     unsigned m_errCnt;
+    uint8_t m_alertStatus;
+    uint8_t m_limitBuf[2][3];
+    // Transactions are queued, so the command bytes live here (not on the stack).
+    uint8_t m_cmd[E_NUM_XFERS];
+    STwiXfer m_xfer[E_NUM_XFERS];
+    void setupXfer(uint8_t slot, uint8_t cmd, uint8_t *data_rd, uint8_t bytes_rd);
+    void queueConfig(void);
 
   public:
     CAd7997(const uint8_t i2cAddr);
     ~CAd7997(void);
-    void begin(void);
-    void start(void);
+    // The alert mode sets up the limit registers (wide open until setWindow()).
+    void begin(bool alertMode = false);
+    // Convert and read all channels in one transaction.
+    void start(void) { startSequence(E_ALL_CHANNELS); }
+    // Convert and read the channels in mask (bit 0 is CH1) in one transaction,
+    // the channel select is rewritten first when it differs from the last one
+    // (mask must not be 0).
+    void startSequence(uint8_t mask);
+    // Make the results of the last completed start() current, false (keeping
+    // the previous results) when that sequence failed.
+    bool latch(void);
+    // Convert and read one channel (only one of these may be queued at a time).
+    // The result goes straight to the front slot (no latch() needed).
     void start(uint8_t index);
     void sync(void);
     void sync(uint8_t index);
     bool isBusy(void) { return twi_busy(); }
+    unsigned errCount(void) { return m_errCnt; }
+    // Set when the channel was converted in the latched sequence.
+    bool sampled(uint8_t index) { return (m_inMask[m_inSlot] >> index) & 1; }
+    // Alert mode - set when any result of the last conversion sequence flagged an alert.
+    bool alertFlagged(void) {
+      for (uint8_t i = 0; i < E_NUM_PORTS; i++) {
+        if (sampled(i) && (m_inBytes[m_inSlot][2 * i] & E_RESULT_ALERT_FLAG))
+          return true;
+      }
+      return false;
+    }
+    // Read and clear the alert status (waits until done).
+    uint8_t syncAlerts(void);
+    static bool alerted(uint8_t alerts, uint8_t index) { return (index < E_NUM_LIMIT_PORTS) && ((alerts >> (2 * index)) & 0x03); }
+    // Move the limit window of a channel with limit registers (waits for the bus).
+    void setWindow(uint8_t index, uint16_t low, uint16_t high);
     uint16_t read(uint8_t index) {
-      if (((m_inBytes[2 * index] >> 4) & 0x07) != index) {
-        // Error - TODO - FIXME - have error handling.
+      const uint8_t *in = m_inBytes[m_inSlot];
+      if (((in[2 * index] >> 4) & 0x07) != index) {
+        // Not the channel expected - keep the last good value.
         m_errCnt++;
-        return 0;
+        twi_count_data_error(m_i2cAddr);
+        return m_values[index];
       }
       // Note: Big endian from the AD7997.
-      return ((m_inBytes[2 * index] & 0x0f) << 8) + m_inBytes[(2 * index) + 1];
+      m_values[index] = ((in[2 * index] & 0x0f) << 8) + in[(2 * index) + 1];
+      return m_values[index];
     }
 };
 
@@ -11,25 +11,43 @@
 #include "Cat9555.h"
 #include "twi_if.h"
 
-CCat9555::CCat9555(const uint8_t i2cAddr, const uint8_t portNum, const uint8_t portConfig) :
+CCat9555::CCat9555(const uint8_t i2cAddr, const uint16_t portConfig) :
   m_i2cAddr(i2cAddr),
-  m_portNum(portNum),
   m_portConfig(portConfig)
 {
-  m_in.port = 0xff;
-  m_out.port = 0xff;
+  m_inPorts[0] = 0xffff;
+  m_inPorts[1] = 0xffff;
+  m_inSlot = 0;
+  m_out.ports = 0xffff;
+
+  // Transactions are queued, so the command bytes live here (not on the stack).
+  m_xferIn.address = i2cAddr;
+  m_xferIn.data_wr = &m_inCmd;
+  m_xferIn.bytes_wr = sizeof(m_inCmd);
+  m_xferIn.data_rd = (uint8_t *)(&m_inPorts[1]);
+  m_xferIn.bytes_rd = sizeof(m_inPorts[1]);
+  m_xferIn.complete_callback = NULL;
+  m_xferIn.status = TWI_XFER_DONE;
+
+  m_xferOut.address = i2cAddr;
+  m_xferOut.data_wr = (uint8_t *)(&m_out);
+  m_xferOut.bytes_wr = sizeof(m_out);
+  m_xferOut.data_rd = NULL;
+  m_xferOut.bytes_rd = 0;
+  m_xferOut.complete_callback = NULL;
+  m_xferOut.status = TWI_XFER_DONE;
 }
 
 CCat9555::~CCat9555(void)
 {
 }
 
-void CCat9555::begin(uint8_t outValue)
+void CCat9555::begin(uint16_t outValue)
 {
-  // Setup the port configuration.
-  m_out.cmd = ECREG_PORT_CONFIG + m_portNum;
-  m_out.port = m_portConfig;
-  twi_initiate_write(m_i2cAddr, (uint8_t *)(&m_out), sizeof(m_out));
+  // Setup the port configuration (both ports).
+  m_out.cmd = ECREG_PORT_CONFIG;
+  m_out.ports = m_portConfig;
+  twi_queue_transaction(&m_xferOut);
   twi_wait_until_master_ready();
 
   // Set the initial output value.
@@ -42,14 +60,15 @@ void CCat9555::begin(uint8_t outValue)
 
 void CCat9555::startOut(void)
 {
-  m_out.cmd = ECREG_OUTPUT + m_portNum;
-  twi_initiate_write(m_i2cAddr, (uint8_t *)(&m_out), sizeof(m_out));
+  m_out.cmd = ECREG_OUTPUT;
+  twi_queue_transaction(&m_xferOut);
 }
 
 void CCat9555::startIn(void)
 {
-  m_in.cmd = ECREG_INPUT + m_portNum;
-  twi_initiate_transaction(m_i2cAddr, &m_in.cmd, sizeof(m_in.cmd), &m_in.port, sizeof(m_in.port));
+  m_inCmd = ECREG_INPUT;
+  m_xferIn.data_rd = (uint8_t *)(&m_inPorts[m_inSlot ^ 1]);
+  twi_queue_transaction(&m_xferIn);
 }
 
 void CCat9555::syncOut(void)
@@ -62,5 +81,13 @@ void CCat9555::syncIn(void)
 {
   startIn();
   twi_wait_until_master_ready();
+  latchIn();
 }
 
+void CCat9555::latchIn(void)
+{
+  // Only after the read completed (the ISR is done with the back slot),
+  // a failed read keeps the previous inputs.
+  if (m_xferIn.status == TWI_XFER_DONE)
+    m_inSlot ^= 1;
+}
@@ -13,14 +13,24 @@
 #include "Arduino.h"
 #include "twi_if.h"
 
+// Command byte followed by both ports (the CAT9555 auto-increments from
+// port 0 to port 1).  Port 0 is the low byte of the 16 bit shadow.
+// Inputs are double buffered - startIn() reads into the back slot while
+// read() keeps returning the front slot until latchIn() swaps them.
 struct __attribute__ ((packed)) SCat9555Buf
 {
   uint8_t cmd;
-  uint8_t port;
+  uint16_t ports;
 };
 
 class CCat9555
 {
+  public:
+    enum properties
+    {
+      E_NUM_PORTS = 2,
+    };
+
   private:
     enum cmd_reg
     {
@@ -29,28 +39,45 @@ class CCat9555
       ECREG_IN_INV = 4,
       ECREG_PORT_CONFIG = 6,
     };
-    enum properties
-    {
-      E_NUM_PORTS = 2,
-    };
-    SCat9555Buf m_in;
+    uint8_t m_inCmd;
+    uint16_t m_inPorts[2];
+    uint8_t m_inSlot;
     SCat9555Buf m_out;
-    const uint8_t m_portConfig;
+    STwiXfer m_xferIn;
+    STwiXfer m_xferOut;
+    const uint16_t m_portConfig;
     const uint8_t m_i2cAddr;
-    const uint8_t m_portNum;
 
   public:
-    CCat9555(const uint8_t i2cAddr, const uint8_t portNum, const uint8_t portConfig);
+    CCat9555(const uint8_t i2cAddr, const uint16_t portConfig);
     ~CCat9555(void);
-    void begin(uint8_t outValue = 0xff);
+    void begin(uint16_t outValue = 0xffff);
+    // Transfer both ports in one transaction.
     void startOut(void);
     void startIn(void);
     void syncOut(void);
     void syncIn(void);
+    // Make the inputs of the last completed startIn() current.
+    void latchIn(void);
     bool isBusy(void) { return twi_busy(); }
-    inline void write(uint8_t outValue) { m_out.port = outValue; }
-    inline uint16_t read(void) { return (m_in.port & m_portConfig) | (m_out.port & ~ m_portConfig); }
+    inline void write(uint16_t outValue) { m_out.ports = outValue; }
+    inline uint16_t read(void) { return (m_inPorts[m_inSlot] & m_portConfig) | (m_out.ports & ~ m_portConfig); }
+    inline void write(uint8_t portNum, uint8_t outValue) { ((uint8_t *)&m_out.ports)[portNum] = outValue; }
+    inline uint8_t read(uint8_t portNum) { return read() >> (8 * portNum); }
 };
 
-#endif
+// View of one 8 bit port of a CAT9555.
+class CCat9555Port
+{
+  private:
+    CCat9555 &m_device;
+    const uint8_t m_portNum;
 
+  public:
+    CCat9555Port(CCat9555 &device, const uint8_t portNum) : m_device(device), m_portNum(portNum) { }
+    ~CCat9555Port(void) { }
+    inline void write(uint8_t outValue) { m_device.write(m_portNum, outValue); }
+    inline uint8_t read(void) { return m_device.read(m_portNum); }
+};
+
+#endif
@@ -0,0 +1,43 @@
+/////////////////////////////////////////////////////////////////////
+// Response curves for mapping analogue values to MIDI.
+//
+// Copyright 2018, Darcy Watkins
+// All Rights Reserved.
+//
+// Available under Mozilla Public License Version 2.0
+// See the LICENSE file for license terms.
+/////////////////////////////////////////////////////////////////////
+#include "Arduino.h"
+
+#include "Curve.h"
+
+// Points at x = i / 16 (i = 0 - 16) scaled by 4096, so the last point lies one
+// past the largest input and the linear table maps every input to itself.
+const PROGMEM uint16_t curveTables[CCurve::E_NUM_CURVES][CCurve::E_CURVE_POINTS] =
+{
+  // Linear: y = x
+  { 0, 256, 512, 768, 1024, 1280, 1536, 1792, 2048, 2304, 2560, 2816, 3072, 3328, 3584, 3840, 4096 },
+  // Log: y = log10(1 + 9x)
+  { 0, 794, 1341, 1759, 2097, 2381, 2625, 2841, 3033, 3206, 3364, 3509, 3643, 3767, 3884, 3993, 4096 },
+  // Anti-log: y = (10^x - 1) / 9
+  { 0, 70, 152, 246, 354, 479, 624, 791, 984, 1207, 1464, 1761, 2104, 2500, 2958, 3486, 4096 },
+  // S-curve: y = 3x^2 - 2x^3
+  { 0, 46, 176, 378, 640, 950, 1296, 1666, 2048, 2430, 2800, 3146, 3456, 3718, 3920, 4050, 4096 },
+  // Custom: y = (x + x^3) / 2
+  { 0, 128, 260, 398, 544, 702, 876, 1068, 1280, 1516, 1780, 2074, 2400, 2762, 3164, 3608, 4096 },
+};
+
+uint16_t CCurve::map(uint8_t curve, uint16_t index)
+{
+  if (index > E_CURVE_MAX)
+    index = E_CURVE_MAX;
+  if (curve >= E_NUM_CURVES)
+    curve = E_CURVE_LINEAR;
+  const uint16_t *p = &curveTables[curve][index >> E_CURVE_SEGMENT_SHIFT];
+  uint16_t y0 = pgm_read_word(p);
+  uint16_t y1 = pgm_read_word(p + 1);
+  uint8_t frac = index & ((1 << E_CURVE_SEGMENT_SHIFT) - 1);
+  // The curves are monotonic, so y1 >= y0, and the last segment stops short
+  // of its end point (4096), so the result is at most E_CURVE_MAX.
+  return y0 + (uint16_t)(((uint32_t)(y1 - y0) * frac) >> E_CURVE_SEGMENT_SHIFT);
+}
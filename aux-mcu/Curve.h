@@ -0,0 +1,42 @@
+/////////////////////////////////////////////////////////////////////
+// Response curves for mapping analogue values to MIDI.
+//
+// Copyright 2018, Darcy Watkins
+// All Rights Reserved.
+//
+// Available under Mozilla Public License Version 2.0
+// See the LICENSE file for license terms.
+/////////////////////////////////////////////////////////////////////
+#ifndef __CURVE_H
+#define __CURVE_H
+
+#include "Arduino.h"
+
+// Each curve is a PROGMEM table of E_CURVE_POINTS points, one every 256 steps
+// of the 12 bit input (the last at 4096), interpolated linearly between them.  New shapes are
+// just another table (and an entry in ECurves).
+class CCurve
+{
+  public:
+    enum properties
+    {
+      E_CURVE_SEGMENT_SHIFT = 8,
+      E_CURVE_POINTS = (4096 >> E_CURVE_SEGMENT_SHIFT) + 1,
+      E_CURVE_MAX = 4095,
+    };
+    enum ECurves
+    {
+      E_CURVE_LINEAR,
+      E_CURVE_LOG,      // Fast rise, fine control at the top.
+      E_CURVE_ANTILOG,  // Fine control at the bottom (audio taper).
+      E_CURVE_S,        // Fine control at both ends.
+      E_CURVE_CUSTOM,   // Fine control near the origin (joystick).
+
+      E_NUM_CURVES
+    };
+
+    // Map a 12 bit value (0 - 4095) through a curve.
+    static uint16_t map(uint8_t curve, uint16_t index);
+};
+
+#endif
@@ -10,6 +10,7 @@
 #include "Arduino.h"
 
 #include "Drawbar.h"
+#include "Trace.h"
 
 extern bool debug_mode;
 void drawbarChanged(uint8_t val, uint8_t ccNum, uint8_t uCase);
@@ -91,29 +92,6 @@ void CDrawbar::changed(uint8_t ccNum, uint8_t uCase)
   if (!debug_mode) {
     // Using serial for MIDI.
     drawbarChanged(m_drawbarVal, ccNum, uCase);
-  } else {
-    char mbuffer[16];
-    Serial.print(F("Drawbar: "));
-    strncpy_P(mbuffer, m_drawbarName, sizeof(mbuffer) - 1);
-    Serial.print(mbuffer);
-    Serial.print(F(" [ "));
-    Serial.print(m_drawbarVal / 4);
-    switch (m_drawbarVal % 4)
-    {
-      case 0:
-        Serial.print(F(".0"));
-        break;
-      case 1:
-        Serial.print(F(".25"));
-        break;
-      case 2:
-        Serial.print(F(".5"));
-        break;
-      case 3:
-        Serial.print(F(".75"));
-        break;
-    }
-    Serial.println(F(" ]"));
   }
+  trace.record(E_TR_DRAWBAR, m_drawbarVal, m_drawbarName);
 }
-
@@ -1,5 +1,5 @@
 /////////////////////////////////////////////////////////////////////
-// Filter that translates analogue input stream into CC like events.
+// Filter bank that translates analogue input streams into CC like events.
 //
 // Copyright 2018, Darcy Watkins
 // All Rights Reserved.
@@ -10,157 +10,221 @@
 #include "Arduino.h"
 
 #include "Filter.h"
+#include "Trace.h"
 
 extern bool debug_mode;
-void analogChanged(bool state, uint16_t val, uint8_t ccNum, uint8_t uCase);
+void analogChanged(bool state, uint16_t val, uint8_t mapping);
 
-CFilter::CFilter(const char *filterName, const enum filter filt, const uint16_t thresh,
-      const uint16_t origin, const uint16_t originMargin, const uint16_t minv,
-      const uint16_t minMargin, const uint16_t maxv, const uint16_t maxMargin,
-      const uint8_t ccNum, const uint8_t useCase) :
-  m_filterName(filterName),
-  m_filter(filt),
-  m_threshold(thresh),
-  m_origin(origin),
-  m_originMargin(originMargin),
-  m_min(minv),
-  m_minMargin(minMargin),
-  m_max(maxv),
-  m_maxMargin(maxMargin),
-  m_state(E_FILT_REST),
-  m_region(E_FILT_AT_ORIGIN),
-  m_timeStart(0),
-  m_filteredValue(0),
-  m_lastValue(0),
-  m_ccNum(ccNum),
-  m_useCase(useCase)
+CFilterBankBase::CFilterBankBase(const SFilterConfig *config, uint8_t size, SFilterParams *param,
+      uint16_t *filteredValue, uint16_t *lastValue, uint32_t *timeStart, uint8_t *status, uint8_t *count) :
+  m_config(config),
+  m_param(param),
+  m_filteredValue(filteredValue),
+  m_lastValue(lastValue),
+  m_timeStart(timeStart),
+  m_status(status),
+  m_count(count),
+  m_size(size),
+  m_channels(0)
 {
+  for (uint8_t ch = 0; ch < E_NUM_CHANNELS; ch++)
+    m_index[ch] = -1;
+  for (uint8_t i = 0; i < m_size; i++) {
+    SFilterConfig cfg;
+    memcpy_P(&cfg, &m_config[i], sizeof(cfg));
+    m_param[i].channel = cfg.channel;
+    m_param[i].threshold = cfg.threshold;
+    m_param[i].origin = cfg.origin;
+    m_param[i].originMargin = cfg.originMargin;
+    m_param[i].minEdge = cfg.min + cfg.minMargin;
+    m_param[i].maxEdge = cfg.max - cfg.maxMargin;
+    m_filteredValue[i] = 0;
+    m_lastValue[i] = 0;
+    m_timeStart[i] = 0;
+    m_status[i] = E_FILT_AT_ORIGIN;
+    m_count[i] = 0;
+    m_channels |= 1 << cfg.channel;
+    m_index[cfg.channel] = i;
+  }
+}
+
+void CFilterBankBase::begin(uint8_t channel, uint16_t sample)
+{
+  int8_t i = find(channel);
+  if (i < 0)
+    return;
+  m_lastValue[i] = sample;
+  m_filteredValue[i] = sample;
+}
+
+bool CFilterBankBase::atOrigin(uint8_t channel)
+{
+  int8_t i = find(channel);
+  return (i >= 0) && (m_status[i] == E_FILT_AT_ORIGIN);
+}
+
+bool CFilterBankBase::atRest(uint8_t channel)
+{
+  int8_t i = find(channel);
+  return (i >= 0) && !(m_status[i] & E_FILT_NOT_AT_REST);
 }
 
-CFilter::~CFilter(void)
+uint16_t CFilterBankBase::filteredValue(uint8_t channel)
 {
+  int8_t i = find(channel);
+  return (i >= 0) ? m_filteredValue[i] : 0;
 }
 
-void CFilter::scan(uint16_t sample, uint32_t sTime)
+uint16_t CFilterBankBase::threshold(uint8_t channel)
 {
-  // First apply the filter.
-  sample = applyFilter(sample);
-  enum region where = inRegion(sample);
-  if (where == m_region)
+  int8_t i = find(channel);
+  return (i >= 0) ? m_param[i].threshold : 0;
+}
+
+enum CFilterBankBase::region CFilterBankBase::inRegion(const SFilterParams &param, uint16_t sample,
+  enum region current)
+{
+  // Hysteresis - the edges of the current region are pushed out by half the
+  // threshold, so a sample sitting on an edge doesn't flip back and forth.
+  uint16_t hyst = param.threshold >> 1;
+  int originMargin = param.originMargin;
+  uint16_t minEdge = param.minEdge;
+  uint16_t maxEdge = param.maxEdge;
+  if ((current == E_FILT_AT_ORIGIN) && originMargin)
+    originMargin += hyst;
+  else if (current == E_FILT_AT_MIN)
+    minEdge += hyst;
+  else if (current == E_FILT_AT_MAX)
+    maxEdge -= hyst;
+
+  if (abs(((int)sample) - ((int)param.origin)) < originMargin)
+    return E_FILT_AT_ORIGIN;
+  if (sample < param.origin)
   {
-    // No change in region since the previous scan.
-    if (m_state == E_FILT_VALIDATING)
+    // We are below the origin.
+    if (sample <= minEdge)
+      return E_FILT_AT_MIN;
+    return E_FILT_IN_LOWER_REGION;
+  }
+  if (sample >= maxEdge)
+    return E_FILT_AT_MAX;
+  return E_FILT_IN_UPPER_REGION;
+}
+
+void CFilterBankBase::update(uint8_t i, uint16_t sample, uint32_t sTime)
+{
+  const SFilterParams &param = m_param[i];
+
+  m_filteredValue[i] = sample;
+  uint8_t status = m_status[i];
+  enum region region = (enum region)(status & E_FILT_REGION_MASK);
+  enum region prev = (enum region)((status >> E_FILT_PREV_SHIFT) & E_FILT_REGION_MASK);
+  enum region where = inRegion(param, sample, region);
+  bool active = (where == E_FILT_IN_LOWER_REGION) || (where == E_FILT_IN_UPPER_REGION);
+
+  if ((status & E_FILT_NOT_AT_REST) && (where != region))
+  {
+    // A change in region occurred before completing validation.
+    if (where == prev)
     {
-      // Still validating entry to this region.
-      if ((sTime - m_timeStart) >= E_TIMEVALIDATE)
+      // Appears to have reverted back to where it came from, so cancel the
+      // validation to filter (ignore) the glitch, retracting a jump already
+      // reported.
+      m_status[i] = where;
+      if (active || (status & E_FILT_PROVISIONAL))
       {
-        // Complete the validation because time threshold reached.
-        m_lastValue = sample;
-        changed();
-        m_timeStart = sTime;
-        m_state = E_FILT_REST;
+        m_lastValue[i] = sample;
+        changed(i);
+        m_timeStart[i] = sTime;
       }
     }
-    else if ((m_region == E_FILT_IN_LOWER_REGION) || (m_region == E_FILT_IN_UPPER_REGION))
+    else
     {
-      // We are validated as in an active region, so check for movement.
-      if ((abs(((int)sample) - ((int)m_lastValue)) >= ((int)m_threshold)) && ((sTime - m_timeStart) >= E_TIMEUPDATE))
-      {
-        // Either we changed beyond a threshold, or we have changed since the last time interval.
-        m_lastValue = sample;
-        changed();
-        m_timeStart = sTime;
-      }
+      // Otherwise it went somewhere new, restart the validation for the new
+      // region, keeping the region to go back to (a jump already reported
+      // still stands, and is validated as a normal change from here).
+      if (status & E_FILT_PROVISIONAL)
+        prev = region;
+      m_status[i] = where | (prev << E_FILT_PREV_SHIFT) | E_FILT_VALIDATING;
+      m_count[i] = 1;
     }
   }
-  else if (m_state == E_FILT_VALIDATING)
+  else if (status & E_FILT_NOT_AT_REST)
   {
-    // A change in region occurred before completing validation.
-    if (where == inRegion(m_lastValue))
+    // Still in the region being validated.
+    if (++m_count[i] >= E_VALIDATE_SAMPLES)
     {
-      // Appears to have reverted back to where it came from.
-      m_region = where;
-      if ((m_region == E_FILT_IN_LOWER_REGION) || (m_region == E_FILT_IN_UPPER_REGION))
+      m_status[i] = region;
+      if (status & E_FILT_VALIDATING)
       {
-        // In an active region for movement so sync up value.
-        m_lastValue = sample;
-        changed();
-        m_timeStart = sTime;
+        // Complete the validation because enough samples agree.
+        m_lastValue[i] = sample;
+        changed(i);
+        m_timeStart[i] = sTime;
       }
-      // Cancel the validation to filter (ignore) the glitch.
-      m_state = E_FILT_REST;
     }
-    else
+  }
+  else if (where == region)
+  {
+    // No change in region since the previous scan.
+    if (active)
     {
-      // Otherwise it jumped somewhere new, restart the validation for the new
-      // region, but don't change the last region that had been validated.
-      m_region = where;
-      m_timeStart = sTime;
+      // We are validated as in an active region, so check for movement.
+      if ((abs(((int)sample) - ((int)m_lastValue[i])) >= ((int)param.threshold)) && ((sTime - m_timeStart[i]) >= E_TIMEUPDATE))
+      {
+        // Either we changed beyond a threshold, or we have changed since the last time interval.
+        m_lastValue[i] = sample;
+        changed(i);
+        m_timeStart[i] = sTime;
+      }
     }
   }
+  else if (abs(((int)sample) - ((int)m_lastValue[i])) >= E_JUMP)
+  {
+    // A decisive jump to another region - report it now, it is confirmed
+    // (or retracted) by the samples that follow.
+    m_status[i] = where | (region << E_FILT_PREV_SHIFT) | E_FILT_PROVISIONAL;
+    m_count[i] = 1;
+    m_lastValue[i] = sample;
+    changed(i);
+    m_timeStart[i] = sTime;
+  }
   else
   {
     // A change in region that needs to be validated.
-    m_region = where;
-    m_timeStart = sTime;
-    m_state = E_FILT_VALIDATING;
-    // Note: Don't change m_S->m_lastValue in case it jumps back.
+    m_status[i] = where | (region << E_FILT_PREV_SHIFT) | E_FILT_VALIDATING;
+    m_count[i] = 1;
+    // Note: Don't change m_lastValue in case it jumps back.
   }
 }
 
-void CFilter::changed(void)
+void CFilterBankBase::changed(uint8_t i)
 {
+  const SFilterParams &param = m_param[i];
+  bool state = false;
+  uint16_t val = 0;
+  switch (m_status[i] & E_FILT_REGION_MASK)
+  {
+    case E_FILT_AT_ORIGIN:
+      break;
+    case E_FILT_AT_MIN:
+      val = param.origin - param.originMargin - param.minEdge;
+      break;
+    case E_FILT_IN_LOWER_REGION:
+      val = param.origin - param.originMargin - m_lastValue[i];
+      break;
+    case E_FILT_AT_MAX:
+      val = param.maxEdge - param.origin - param.originMargin;
+      state = true;
+      break;
+    case E_FILT_IN_UPPER_REGION:
+      state = true;
+      val = m_lastValue[i] - param.origin - param.originMargin;
+      break;
+  }
   if (!debug_mode) {
     // Using serial for MIDI.
-    bool state = false;
-    uint16_t val = 0;
-    switch (m_region)
-    {
-      case E_FILT_AT_ORIGIN:
-        break;
-      case E_FILT_AT_MIN:
-        val = m_origin - m_originMargin - m_min - m_minMargin;
-        break;
-      case E_FILT_IN_LOWER_REGION:
-        val = m_origin - m_originMargin - m_lastValue;
-        break;
-      case E_FILT_AT_MAX:
-        val = m_max - m_maxMargin - m_origin - m_originMargin;
-        state = true;
-        break;
-      case E_FILT_IN_UPPER_REGION:
-        state = true;
-        val = m_lastValue - m_origin - m_originMargin;
-        break;
-    }
-    analogChanged(state, val, m_ccNum, m_useCase);
-  } else {
-    char mbuffer[12];
-    Serial.print(F("Filter: "));
-    strncpy_P(mbuffer, m_filterName, sizeof(mbuffer) - 1);
-    Serial.print(mbuffer);
-    switch (m_region)
-    {
-      case E_FILT_AT_ORIGIN:
-        Serial.println(F(" origin"));
-        break;
-      case E_FILT_AT_MIN:
-        Serial.print(F(" min: "));
-        Serial.println(m_origin - m_originMargin - m_min - m_minMargin);
-        break;
-      case E_FILT_IN_LOWER_REGION:
-        Serial.print(F(" lower: "));
-        Serial.println(m_origin - m_originMargin - m_lastValue);
-        break;
-      case E_FILT_AT_MAX:
-        Serial.print(F(" max: "));
-        Serial.println(m_max - m_maxMargin - m_origin - m_originMargin);
-        break;
-      case E_FILT_IN_UPPER_REGION:
-        Serial.print(F(" upper: "));
-        Serial.println(m_lastValue - m_origin - m_originMargin);
-        break;
-    }
+    analogChanged(state, val, pgm_read_byte(&m_config[i].mapping));
   }
+  trace.record(E_TR_FILTER, m_status[i] & E_FILT_REGION_MASK, (const char *)pgm_read_ptr(&m_config[i].name), val);
 }
-
@@ -1,5 +1,5 @@
 /////////////////////////////////////////////////////////////////////
-// Filter that translates analogue input stream into CC like events.
+// Filter bank that translates analogue input streams into CC like events.
 //
 // Copyright 2018, Darcy Watkins
 // All Rights Reserved.
@@ -12,29 +12,86 @@
 
 #include "Arduino.h"
 
-class CFilter
+// Configuration of one filter (kept in PROGMEM).
+struct SFilterConfig
+{
+  const char *name;     // PROGMEM string.
+  uint8_t channel;      // ADC channel.
+  uint8_t mapping;      // Row of the analogue to MIDI mapping.
+  uint16_t threshold;
+  uint16_t origin;
+  uint16_t originMargin;
+  uint16_t min;
+  uint16_t minMargin;
+  uint16_t max;
+  uint16_t maxMargin;
+};
+
+// The fields of a filter's config used on every sample, copied to RAM with
+// the margins applied to the region edges.
+struct SFilterParams
+{
+  uint8_t channel;
+  uint16_t threshold;
+  uint16_t origin;
+  uint16_t originMargin;
+  uint16_t minEdge;     // min + minMargin
+  uint16_t maxEdge;     // max - maxMargin
+};
+
+// Smoothing policies - weight of the new sample in 1/8ths, the rest to the
+// previous filtered value.
+template <uint8_t TWeight>
+struct CFiltEma
+{
+  inline uint16_t apply(uint8_t i, uint16_t sample, uint16_t filtered)
+  {
+    return ((sample * TWeight) + (filtered * (8 - TWeight)) + (1 << 2)) >> 3;
+  }
+};
+typedef CFiltEma<8> CFiltNone;
+typedef CFiltEma<1> CFilt0p125;
+typedef CFiltEma<5> CFilt0p625;
+
+// Speed adaptive smoothing (one euro style) - the weight of the new sample
+// (in 1/16ths) rises from TMinWeight with the smoothed rate of change, so a
+// still control is heavily smoothed while fast gestures pass with little lag.
+template <uint8_t N, uint8_t TMinWeight, uint8_t TSpeedShift>
+class CFiltAdaptive
+{
+  private:
+    uint16_t m_speed[N]; // Smoothed |sample - filtered| (x4, 1/4 weight to each new one).
+
+  public:
+    CFiltAdaptive(void) : m_speed{ 0 } { }
+    inline uint16_t apply(uint8_t i, uint16_t sample, uint16_t filtered)
+    {
+      uint16_t delta = (sample > filtered) ? (sample - filtered) : (filtered - sample);
+      m_speed[i] = m_speed[i] - (m_speed[i] >> 2) + delta;
+      uint16_t weight = TMinWeight + (m_speed[i] >> TSpeedShift);
+      if (weight > 16)
+        weight = 16;
+      return ((sample * weight) + (filtered * (16 - weight)) + (1 << 3)) >> 4;
+    }
+};
+
+// Region tracking and event generation shared by all the banks, the state
+// is held as arrays (one entry per filter) owned by CFilterBank.
+class CFilterBankBase
 {
   private:
-    const char *m_filterName;
-    const uint8_t m_filter;
-    const uint16_t m_threshold;
-    const uint16_t m_origin;
-    const uint16_t m_originMargin;
-    const uint16_t m_min;
-    const uint16_t m_minMargin;
-    const uint16_t m_max;
-    const uint16_t m_maxMargin;
     enum
     {
-      E_TIMEVALIDATE = 20000,
       E_TIMEUPDATE = 10000,
+      // A region change is validated by this many consecutive samples in
+      // the new region (so the delay follows the sample rate).
+      E_VALIDATE_SAMPLES = 3,
+      // A change this big is reported at once, and retracted if the next
+      // sample goes back to where it came from.
+      E_JUMP = 512,
+      // ADC channels (the bank's channel mask is a byte).
+      E_NUM_CHANNELS = 8,
     };
-    enum state
-    {
-      E_FILT_REST,
-      E_FILT_VALIDATING,
-    };
-    enum state m_state;
     enum region
     {
       E_FILT_AT_ORIGIN,
@@ -43,64 +100,77 @@ class CFilter
       E_FILT_AT_MAX,
       E_FILT_IN_UPPER_REGION,
     };
-    enum region m_region;
-    uint16_t m_filteredValue;
-    uint16_t m_lastValue;
-    unsigned long m_timeStart;
-    const uint8_t m_ccNum;
-    const uint8_t m_useCase;
-
-  public:
-    enum filter
+    enum status
     {
-      E_FILT_NO_FILTER = 0,
-      E_FILT_0P125,
-      E_FILT_0P625,
+      E_FILT_REGION_MASK = 0x07,
+      E_FILT_PREV_SHIFT = 3,     // Region to go back to while not at rest.
+      E_FILT_PROVISIONAL = 0x40, // Reported on a jump, not yet confirmed.
+      E_FILT_VALIDATING = 0x80,  // Not yet reported.
+      E_FILT_NOT_AT_REST = E_FILT_PROVISIONAL | E_FILT_VALIDATING,
     };
-    CFilter(const char *filterName, const enum filter filt, const uint16_t thresh,
-      const uint16_t origin, const uint16_t originMargin, const uint16_t minv,
-      const uint16_t minMargin, const uint16_t maxv, const uint16_t maxMargin,
-      const uint8_t ccNum = 255, const uint8_t useCase = 0);
-    ~CFilter(void);
-    void begin(uint16_t sample) { m_lastValue = sample; m_filteredValue = sample; }
-    void scan(uint16_t sample, uint32_t sTime);
-    uint16_t applyFilter( uint16_t sample )
+    const SFilterConfig *const m_config;
+    SFilterParams *const m_param;
+    uint16_t *const m_filteredValue;
+    uint16_t *const m_lastValue;
+    uint32_t *const m_timeStart;
+    uint8_t *const m_status;
+    uint8_t *const m_count;
+    const uint8_t m_size;
+    uint8_t m_channels;
+    int8_t m_index[E_NUM_CHANNELS]; // Filter by ADC channel, -1 when not in this bank.
+    inline int8_t find(uint8_t channel) { return (channel < E_NUM_CHANNELS) ? m_index[channel] : -1; }
+    static enum region inRegion(const SFilterParams &param, uint16_t sample, enum region current);
+    void changed(uint8_t i);
+
+  protected:
+    CFilterBankBase(const SFilterConfig *config, uint8_t size, SFilterParams *param, uint16_t *filteredValue,
+      uint16_t *lastValue, uint32_t *timeStart, uint8_t *status, uint8_t *count);
+    inline uint8_t channelMask(void) { return m_channels; }
+    inline uint8_t channel(uint8_t i) { return m_param[i].channel; }
+    inline uint16_t filtered(uint8_t i) { return m_filteredValue[i]; }
+    // Region tracking for a new filtered value.
+    void update(uint8_t i, uint16_t sample, uint32_t sTime);
+
+  public:
+    // Accessors by ADC channel (which must be in this bank).
+    bool has(uint8_t channel) { return (m_channels >> channel) & 1; }
+    void begin(uint8_t channel, uint16_t sample);
+    bool atOrigin(uint8_t channel);
+    bool atRest(uint8_t channel);
+    uint16_t filteredValue(uint8_t channel);
+    uint16_t threshold(uint8_t channel);
+};
+
+// A bank of N filters with the same smoothing, run over the channels of one
+// ADC burst in one pass.
+template <uint8_t N, class TSmooth>
+class CFilterBank : public CFilterBankBase
+{
+  private:
+    SFilterParams m_params[N];
+    uint16_t m_filteredValues[N];
+    uint16_t m_lastValues[N];
+    uint32_t m_timeStarts[N];
+    uint8_t m_statuses[N];
+    uint8_t m_counts[N];
+    TSmooth m_smooth;
+
+  public:
+    CFilterBank(const SFilterConfig *config) :
+      CFilterBankBase(config, N, m_params, m_filteredValues, m_lastValues, m_timeStarts, m_statuses, m_counts)
     {
-      switch (m_filter)
-      {
-        case E_FILT_NO_FILTER:
-        default: // No filter - pass through
-          m_filteredValue = sample;
-          break;
-        case E_FILT_0P125:
-          // Weight 1/8ths to sample, 7/8ths to m_filteredValue.
-          m_filteredValue = (sample + (m_filteredValue << 3) - m_filteredValue + (1 << 2)) >> 3;
-          break;
-        case E_FILT_0P625:
-          // Weight 5/8ths to sample, 3/8ths to m_filteredValue.
-          m_filteredValue = ((sample << 2) + sample + (m_filteredValue << 1) + m_filteredValue + (1 << 2)) >> 3;
-          break;
-      }
-      return m_filteredValue;
     }
-    bool atOrigin(void) { return (m_region == E_FILT_AT_ORIGIN) && (m_state == E_FILT_REST); }
-    enum region inRegion(uint16_t sample)
+    // Filter the channels in mask, samples are indexed by ADC channel.
+    void scan(const uint16_t *samples, uint8_t mask, uint32_t sTime)
     {
-      if (abs(((int)sample) - ((int)m_origin)) < ((int)m_originMargin))
-        return E_FILT_AT_ORIGIN;
-      if (sample < m_origin)
-      {
-        // We are below the origin.
-        if (sample <= (m_min + m_minMargin))
-          return E_FILT_AT_MIN;
-        return E_FILT_IN_LOWER_REGION;
+      if (!(mask & channelMask()))
+        return;
+      for (uint8_t i = 0; i < N; i++) {
+        uint8_t ch = channel(i);
+        if ((mask >> ch) & 1)
+          update(i, m_smooth.apply(i, samples[ch], filtered(i)), sTime);
       }
-      if (sample >= (m_max - m_maxMargin))
-        return E_FILT_AT_MAX;
-      return E_FILT_IN_UPPER_REGION;
     }
-    void changed(void);
 };
 
 #endif
-
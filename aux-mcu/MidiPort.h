@@ -73,6 +73,18 @@ class CMidiPort
         m_serial.write(msgType);
       }
     }
+    inline void sendSysEx(const uint8_t *data, uint8_t len)
+    {
+      if (!m_running)
+        return;
+      // SysEx cancels running status.
+      m_currentStatus = 0;
+      m_serial.write(0xf0);
+      while (len--) {
+        m_serial.write(*(data++) & 0x7f);
+      }
+      m_serial.write(0xf7);
+    }
     inline void activeSense(void) { send( 0xfe, 0, 0, 0 ); if (m_cbSetLed) m_cbSetLed(HIGH); }
     inline void ctrlCh(uint8_t ccNum, uint8_t ccVal, uint8_t channel = 0) { send( 0xb0, ccNum, ccVal, channel ); }
     inline void pitchBend(uint16_t pbVal, uint8_t channel = 0) { send( 0xe0, pbVal & 0x7f, (pbVal >> 7) & 0x7f, channel ); }
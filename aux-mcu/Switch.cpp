@@ -10,6 +10,7 @@
 #include "Arduino.h"
 
 #include "Switch.h"
+#include "Trace.h"
 
 extern bool debug_mode;
 void switchChanged(bool state, uint8_t ccNum, uint8_t uCase);
@@ -92,13 +93,8 @@ void CSwitch::switchOn(uint8_t ccNum, uint8_t uCase)
   if (!debug_mode) {
     // Using serial for MIDI.
     switchChanged(true, ccNum, uCase);
-  } else {
-    char mbuffer[12];
-    Serial.print(F("Switch: "));
-    strncpy_P(mbuffer, m_switchName, sizeof(mbuffer) - 1);
-    Serial.print(mbuffer);
-    Serial.println(F(" on"));
   }
+  trace.record(E_TR_SWITCH, 1, m_switchName);
 }
 
 void CSwitch::switchOff(uint8_t ccNum, uint8_t uCase)
@@ -106,12 +102,7 @@ void CSwitch::switchOff(uint8_t ccNum, uint8_t uCase)
   if (!debug_mode) {
     // Using serial for MIDI.
     switchChanged(false, ccNum, uCase);
-  } else {
-    char mbuffer[12];
-    Serial.print(F("Switch: "));
-    strncpy_P(mbuffer, m_switchName, sizeof(mbuffer) - 1);
-    Serial.print(mbuffer);
-    Serial.println(F(" off"));
   }
+  trace.record(E_TR_SWITCH, 0, m_switchName);
 }
 
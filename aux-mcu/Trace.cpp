@@ -0,0 +1,117 @@
+/////////////////////////////////////////////////////////////////////
+// Compact binary trace ring (replaces blocking debug text output).
+//
+// Copyright 2018, Darcy Watkins
+// All Rights Reserved.
+//
+// Available under Mozilla Public License Version 2.0
+// See the LICENSE file for license terms.
+/////////////////////////////////////////////////////////////////////
+#include "Arduino.h"
+
+#include "Trace.h"
+
+CTrace::CTrace(void) :
+  m_head(0),
+  m_tail(0),
+  m_lost(0),
+  m_rxIdx(0)
+{
+}
+
+CTrace::~CTrace(void)
+{
+}
+
+void CTrace::record(const STraceRecord &rec)
+{
+  m_ring[m_head] = rec;
+  m_head = (m_head + 1) & E_RING_MASK;
+  if (m_head == m_tail) {
+    m_tail = (m_tail + 1) & E_RING_MASK;
+    m_lost++;
+  }
+}
+
+bool CTrace::pop(STraceRecord &rec)
+{
+  if (m_lost) {
+    // Report the overrun ahead of what is left.
+    rec.time = micros();
+    rec.id = E_TR_LOST;
+    rec.arg = 0;
+    rec.name = 0;
+    rec.val = m_lost;
+    m_lost = 0;
+    return true;
+  }
+  if (m_head == m_tail)
+    return false;
+  rec = m_ring[m_tail];
+  m_tail = (m_tail + 1) & E_RING_MASK;
+  return true;
+}
+
+void CTrace::writeFrame(Print &out, const STraceRecord &rec)
+{
+  uint8_t frame[E_FRAME_SIZE];
+  uint8_t chk = 0;
+  frame[0] = E_FRAME_SYNC;
+  memcpy(&frame[1], &rec, sizeof(rec));
+  for (uint8_t i = 1; i <= sizeof(rec); i++)
+    chk ^= frame[i];
+  frame[E_FRAME_SIZE - 1] = chk;
+  out.write(frame, sizeof(frame));
+}
+
+void CTrace::drain(Print &out)
+{
+  STraceRecord rec;
+  while ((out.availableForWrite() >= E_FRAME_SIZE) && pop(rec)) {
+    writeFrame(out, rec);
+  }
+}
+
+bool CTrace::collect(uint8_t c)
+{
+  if (m_rxIdx == 0) {
+    // Hunting for the start of a frame.
+    if (c != E_FRAME_SYNC)
+      return false;
+    m_rxFrame[m_rxIdx++] = c;
+    return true;
+  }
+  m_rxFrame[m_rxIdx++] = c;
+  if (m_rxIdx < E_FRAME_SIZE)
+    return true;
+
+  // Complete frame - validate and keep it (tagged with the source).
+  m_rxIdx = 0;
+  uint8_t chk = 0;
+  for (uint8_t i = 1; i <= sizeof(STraceRecord); i++)
+    chk ^= m_rxFrame[i];
+  if (chk == m_rxFrame[E_FRAME_SIZE - 1]) {
+    STraceRecord rec;
+    memcpy(&rec, &m_rxFrame[1], sizeof(rec));
+    rec.id |= E_TR_AUX;
+    record(rec);
+  }
+  return true;
+}
+
+uint8_t CTrace::pack(uint8_t *buf, const STraceRecord &rec)
+{
+  // Groups of up to 7 bytes, each preceded by a byte holding their MSBs.
+  const uint8_t *src = (const uint8_t *)&rec;
+  uint8_t len = 0;
+  for (uint8_t i = 0; i < sizeof(rec); i += 7) {
+    uint8_t *msbs = &buf[len++];
+    *msbs = 0;
+    for (uint8_t j = 0; (j < 7) && ((i + j) < sizeof(rec)); j++) {
+      if (src[i + j] & 0x80)
+        *msbs |= (1 << j);
+      buf[len++] = src[i + j] & 0x7f;
+    }
+  }
+  return len;
+}
@@ -25,7 +25,9 @@
 #include "Drawbar.h"
 #include "Switch.h"
 #include "Filter.h"
+#include "Curve.h"
 #include "MidiPort.h"
+#include "Trace.h"
 
 #define FORCE_DEBUG 0
 
@@ -42,7 +44,9 @@
 
 // Constants
 long ledBlinkInterval = 300000; // us
-const long wireClockFrequency = 800000; // Hz - I2C overclocked to 800kHz
+const long wireClockFrequency = 800000; // Hz - I2C overclocked to 800kHz (fastest, slows down on errors)
+// Let the AD7997 limit alerts tell us when CH1 - CH4 move (otherwise scan them all).
+const bool analogAlertMode = false;
 
 // Arduino I/O pin addresses
 #define ARDUINO_LED_PORT PORTB
@@ -72,27 +76,75 @@ const uint16_t REG_T_PORT_CONFIG = 0x01;
 bool ledState = LOW; // used to set the LED
 uint32_t ledPreviousMicros = 0; // will store last time LED was updated
 bool debug_mode;
+CTrace trace;
 
 // Analogue Inputs
 CAd7997 AnalogA(34); // I2C address
 
 // Digital I/O
 // CAT9555 registers are designated in hardware port order.
-CCat9555 RegQ(32, 0, REG_Q_PORT_CONFIG); // I2C address and port config
-CCat9555 RegR(32, 1, REG_R_PORT_CONFIG); // I2C address and port config
-CCat9555 RegS(33, 0, REG_S_PORT_CONFIG); // I2C address and port config
-CCat9555 RegT(33, 1, REG_T_PORT_CONFIG); // I2C address and port config
-
-// Analog filters
-enum EAUseCase
+CCat9555 DigitalA(32, REG_Q_PORT_CONFIG | (REG_R_PORT_CONFIG << 8)); // I2C address and port config
+CCat9555 DigitalB(33, REG_S_PORT_CONFIG | (REG_T_PORT_CONFIG << 8)); // I2C address and port config
+CCat9555Port RegQ(DigitalA, 0);
+CCat9555Port RegR(DigitalA, 1);
+CCat9555Port RegS(DigitalB, 0);
+CCat9555Port RegT(DigitalB, 1);
+
+// Analog to MIDI mapping - the value from a filter (distance from its origin
+// edge) is scaled so its span covers the 12 bit curve input, mapped through
+// the curve, then sent as the kind of output.  A joystick axis switches to
+// its shifted row while the joystick shift is on.
+enum EAnalogOut
 {
-  E_AUC_SIMPLE_CC = 0,
-  E_AUC_SCALED_19_16_CC = 1,
-  E_AUC_JOYSTICK = 2,
-
-  E_AUC_NUM_USECASES
+  E_AOUT_CC,            // ccA = 0 - 127
+  E_AOUT_CC_BIPOLAR,    // ccA (upper side) or ccB (lower side) = 0 - 127, both 0 at the origin
+  E_AOUT_CC_CENTRED,    // ccA = 64 +/- 64
+  E_AOUT_PITCH_BEND,    // 8192 +/- 8192
+};
+enum EAnalogMaps
+{
+  E_AM_TREM_RATE,
+  E_AM_BRILLIANCE,
+  E_AM_VOLUME,
+  E_AM_FC1,
+  E_AM_FC2,
+  E_AM_JOY_X,
+  E_AM_JOY_Y,
+  E_AM_JOY_Z,
+  E_AM_JOY_X_SHIFTED,
+  E_AM_JOY_Y_SHIFTED,
+  E_AM_JOY_Z_SHIFTED,
+
+  E_NUM_ANALOG_MAPS,
+  E_AM_NONE = 0xff,
+};
+struct SAnalogMap
+{
+  uint8_t curve;
+  uint8_t scale;    // In 1/16ths.
+  uint8_t out;
+  uint8_t ccA;
+  uint8_t ccB;
+  uint8_t shifted;  // Row used while the joystick is shifted.
+};
+const PROGMEM SAnalogMap analogMap[E_NUM_ANALOG_MAPS] =
+{
+  // curve                     scale  out                  ccA  ccB  shifted
+  { CCurve::E_CURVE_LINEAR,    16,    E_AOUT_CC,           90,  0,   E_AM_NONE },          // Trem Rate
+  { CCurve::E_CURVE_LINEAR,    16,    E_AOUT_CC,           70,  0,   E_AM_NONE },          // Brilliance
+  { CCurve::E_CURVE_LINEAR,    16,    E_AOUT_CC,           7,   0,   E_AM_NONE },          // Volume
+  { CCurve::E_CURVE_LINEAR,    19,    E_AOUT_CC,           11,  0,   E_AM_NONE },          // FC1
+  { CCurve::E_CURVE_LINEAR,    19,    E_AOUT_CC,           4,   0,   E_AM_NONE },          // FC2
+  { CCurve::E_CURVE_LINEAR,    36,    E_AOUT_CC_BIPOLAR,   1,   2,   E_AM_JOY_X_SHIFTED }, // X - modulation / breath
+  { CCurve::E_CURVE_LINEAR,    34,    E_AOUT_PITCH_BEND,   0,   0,   E_AM_JOY_Y_SHIFTED }, // Y - pitch bend
+  { CCurve::E_CURVE_LINEAR,    36,    E_AOUT_CC_BIPOLAR,   12,  13,  E_AM_JOY_Z_SHIFTED }, // Z - CW / CCW
+  { CCurve::E_CURVE_LINEAR,    36,    E_AOUT_CC_CENTRED,   75,  0,   E_AM_NONE },          // X shifted
+  { CCurve::E_CURVE_LINEAR,    34,    E_AOUT_CC_CENTRED,   76,  0,   E_AM_NONE },          // Y shifted
+  { CCurve::E_CURVE_LINEAR,    36,    E_AOUT_CC_CENTRED,   77,  0,   E_AM_NONE },          // Z shifted
 };
 
+// Analog filters
+
 const PROGMEM char AnalogFilterStr0[] = "Trem Rate";
 const PROGMEM char AnalogFilterStr1[] = "FC2";
 const PROGMEM char AnalogFilterStr2[] = "Brilliance";
@@ -101,17 +153,70 @@ const PROGMEM char AnalogFilterStr4[] = "Volume";
 const PROGMEM char AnalogFilterStr5[] = "JoyZ";
 const PROGMEM char AnalogFilterStr6[] = "JoyX";
 const PROGMEM char AnalogFilterStr7[] = "JoyY";
-CFilter analogFilters[] =
-{
-  //      name              filter                  thresh  origin  ormrgn  min  mnmrgn max    mxmrgn CC   use case
-  CFilter(AnalogFilterStr0, CFilter::E_FILT_0P125,  32,     0,      0,      0,   0,     4095,  0,     90,  E_AUC_SIMPLE_CC),
-  CFilter(AnalogFilterStr1, CFilter::E_FILT_0P625,  32,     0,      594,    0,   0,     4095,  61,    4,   E_AUC_SCALED_19_16_CC),
-  CFilter(AnalogFilterStr2, CFilter::E_FILT_0P125,  32,     0,      0,      0,   0,     4095,  0,     70,  E_AUC_SIMPLE_CC),
-  CFilter(AnalogFilterStr3, CFilter::E_FILT_0P625,  32,     0,      594,    0,   0,     4095,  61,    11,  E_AUC_SCALED_19_16_CC),
-  CFilter(AnalogFilterStr4, CFilter::E_FILT_0P125,  32,     0,      0,      0,   0,     4095,  0,     7,   E_AUC_SIMPLE_CC),
-  CFilter(AnalogFilterStr5, CFilter::E_FILT_0P625,  16,     2016,   130,    0,   56,    4095,  133,   2,   E_AUC_JOYSTICK),
-  CFilter(AnalogFilterStr6, CFilter::E_FILT_0P625,  8,      2010,   100,    0,   80,    4095,  169,   0,   E_AUC_JOYSTICK),
-  CFilter(AnalogFilterStr7, CFilter::E_FILT_0P625,  8,      2044,   96,     0,   18,    4095,  25,    1,   E_AUC_JOYSTICK),
+
+// Filter banks, grouped by smoothing (the filter type is part of the bank, so
+// moving a channel's row between the tables selects its filter).
+// Panel knobs - fixed 1/8 weight, they are set and left.
+const PROGMEM SFilterConfig panelFilterConfig[] =
+{
+  // name              ch  mapping             thresh  origin  ormrgn  min  mnmrgn max    mxmrgn
+  { AnalogFilterStr0,  0,  E_AM_TREM_RATE,     32,     0,      0,      0,   0,     4095,  0   },
+  { AnalogFilterStr2,  2,  E_AM_BRILLIANCE,    32,     0,      0,      0,   0,     4095,  0   },
+};
+CFilterBank<2, CFilt0p125> panelFilters(panelFilterConfig);
+
+// Performance controls - speed adaptive, from 1/16 weight when still up to
+// none when moving fast (about 60 LSB per sample).
+const PROGMEM SFilterConfig controlFilterConfig[] =
+{
+  // name              ch  mapping             thresh  origin  ormrgn  min  mnmrgn max    mxmrgn
+  { AnalogFilterStr1,  1,  E_AM_FC2,           32,     0,      594,    0,   0,     4095,  61  },
+  { AnalogFilterStr3,  3,  E_AM_FC1,           32,     0,      594,    0,   0,     4095,  61  },
+  { AnalogFilterStr4,  4,  E_AM_VOLUME,        32,     0,      0,      0,   0,     4095,  0   },
+  { AnalogFilterStr5,  5,  E_AM_JOY_Z,         16,     2016,   130,    0,   56,    4095,  133 },
+  { AnalogFilterStr6,  6,  E_AM_JOY_X,         8,      2010,   100,    0,   80,    4095,  169 },
+  { AnalogFilterStr7,  7,  E_AM_JOY_Y,         8,      2044,   96,     0,   18,    4095,  25  },
+};
+CFilterBank<6, CFiltAdaptive<6, 1, 4> > controlFilters(controlFilterConfig);
+
+// The bank filtering an analogue channel.
+CFilterBankBase &analog_filter(uint8_t index)
+{
+  if (panelFilters.has(index))
+    return panelFilters;
+  return controlFilters;
+}
+
+// Analog sampling schedule (by channel) - each channel is converted once every period
+// scan slots (a power of 2, at most E_AR_SLOTS), in the slot given by its
+// phase.  The pedals alternate, so the channel select (a config register write
+// of its own) changes before every batch, and the knobs ride along in the pedal
+// slots leaving the odd slots to the joystick axes alone.  Per 8 slots that is
+// 38 conversions and 8 config writes on the bus instead of 64 conversions.
+enum EAnalogRate
+{
+  E_AR_JOYSTICK = 1,    // Every slot.
+  E_AR_PEDAL = 2,       // Every 2nd slot.
+  E_AR_PANEL_KNOB = 8,  // Every 8th slot.
+
+  E_AR_SLOTS = 8,
+};
+struct SAnalogSchedule
+{
+  uint8_t period;
+  uint8_t phase;
+};
+const PROGMEM SAnalogSchedule analogSchedule[] =
+{
+  // period            phase
+  { E_AR_PANEL_KNOB,   2 }, // Trem Rate
+  { E_AR_PEDAL,        0 }, // FC2
+  { E_AR_PANEL_KNOB,   6 }, // Brilliance
+  { E_AR_PEDAL,        0 }, // FC1
+  { E_AR_PEDAL,        0 }, // Volume
+  { E_AR_JOYSTICK,     0 }, // JoyZ
+  { E_AR_JOYSTICK,     0 }, // JoyX
+  { E_AR_JOYSTICK,     0 }, // JoyY
 };
 
 // Logical switch scanner.
@@ -160,6 +265,17 @@ CDrawbar drawbar[] =
 // Aux MCU - the serial port to send the MIDI events to the main MCU (no MIDI-In).
 CMidiPort<HardwareSerial> midiJacks((HardwareSerial&)Serial);
 
+// SysEx messages use the non-commercial manufacturer ID (same as the Main MCU).
+// The Aux MCU has no MIDI-In so these are unsolicited reports, which the Main
+// MCU forwards to the USB internal cable.
+//   Report:   0xf0, SYSEX_ID, command, payload ..., 0xf7
+#define SYSEX_ID 0x7d
+enum ESysExCmds
+{
+  E_SYSX_I2C_HEALTH = 0x04, // One report per I2C device (see sendI2cHealth).
+  E_SYSX_I2C_SPEED = 0x05,  // I2C clock selected (see sendI2cSpeed).
+};
+
 enum EUseCase
 {
   E_UC_SIMPLE_CC = 0,
@@ -188,11 +304,95 @@ void scan_misc_switches( uint32_t timeS )
     READ_BIT(ROTARY_FAST) == 0, 1,   E_UC_ROTARY_CC);
 }
 
-static unsigned analog_ch_index = 0;
+// Alert mode - channels are scanned until they have been at rest for a while,
+// then left to the AD7997 limit window around where they settled.
+enum
+{
+  E_ANALOG_ACTIVE_CYCLES = 32,
+  // An idle channel is still converted once every this many batches, as the
+  // AD7997 only checks a window when it converts the channel.
+  E_ANALOG_REFRESH_BATCHES = 16,
+};
+static uint8_t analog_active[CAd7997::E_NUM_LIMIT_PORTS] =
+{
+  // Scan from startup until settled (the windows start wide open).
+  E_ANALOG_ACTIVE_CYCLES, E_ANALOG_ACTIVE_CYCLES, E_ANALOG_ACTIVE_CYCLES, E_ANALOG_ACTIVE_CYCLES,
+};
+
+// Filter the channels sampled in the latched burst, each bank in one pass.
+void scan_analogs(uint8_t sampled, uint32_t rTime, uint8_t alerts)
+{
+  uint16_t samples[CAd7997::E_NUM_PORTS];
+  uint16_t last[CAd7997::E_NUM_LIMIT_PORTS];
+  uint8_t mask = sampled;
+  uint8_t index;
+
+  if (analogAlertMode) {
+    for (index = 0; index < CAd7997::E_NUM_LIMIT_PORTS; index++) {
+      if (CAd7997::alerted(alerts, index)) {
+        analog_active[index] = E_ANALOG_ACTIVE_CYCLES;
+      } else if (!analog_active[index]) {
+        // Idle - within its window.
+        mask &= ~(1 << index);
+      }
+      last[index] = analog_filter(index).filteredValue(index);
+    }
+  }
+
+  for (index = 0; index < CAd7997::E_NUM_PORTS; index++) {
+    if ((mask >> index) & 1)
+      samples[index] = AnalogA.read(index);
+  }
+  panelFilters.scan(samples, mask, rTime);
+  controlFilters.scan(samples, mask, rTime);
+
+  if (!analogAlertMode)
+    return;
+  for (index = 0; index < CAd7997::E_NUM_LIMIT_PORTS; index++) {
+    if (!((mask >> index) & 1))
+      continue;
+    CFilterBankBase &filter = analog_filter(index);
+    uint16_t val = filter.filteredValue(index);
+    uint16_t thresh = filter.threshold(index);
+    if (!filter.atRest(index) || (abs((int)val - (int)last[index]) >= thresh)) {
+      analog_active[index] = E_ANALOG_ACTIVE_CYCLES;
+    } else if (--analog_active[index] == 0) {
+      // Settled so re-centre the window on where it is now.
+      AnalogA.setWindow(index, (val > thresh) ? (val - thresh) : 0,
+        (val < (CAd7997::E_MAX_VALUE - thresh)) ? (val + thresh) : CAd7997::E_MAX_VALUE);
+    }
+  }
+}
+
+// Channels to convert in a scan slot.
+uint8_t analog_slot_mask( uint8_t slot )
+{
+  uint8_t mask = 0;
+  for (uint8_t i = 0; i < CAd7997::E_NUM_PORTS; i++) {
+    uint8_t period = pgm_read_byte(&analogSchedule[i].period);
+    uint8_t phase = pgm_read_byte(&analogSchedule[i].phase);
+    if (((slot - phase) & (period - 1)) == 0)
+      mask |= (1 << i);
+  }
+  return mask;
+}
 
-void scan_analogs(uint8_t index, uint32_t rTime)
+// Alert mode - leave the channels idle within their windows out of the
+// sequence, but for a refresh conversion that flags the result (and so the
+// whole batch) if one has moved out of its window.
+uint8_t analog_alert_mask( uint8_t mask )
 {
-  analogFilters[index].scan(AnalogA.read(index), rTime);
+  static uint8_t refresh = 0;
+  uint8_t idle = 0;
+  for (uint8_t i = 0; i < CAd7997::E_NUM_LIMIT_PORTS; i++) {
+    if (!analog_active[i])
+      idle |= 1 << i;
+  }
+  if (++refresh >= E_ANALOG_REFRESH_BATCHES) {
+    refresh = 0;
+    return mask | idle;
+  }
+  return mask & ~idle;
 }
 
 static unsigned drawbar_scan_busbar_index = 0;
@@ -210,7 +410,7 @@ void drawbar_select_next_busbar( void )
   RegT.write(val_T);
 }
 
-void drawbar_scan_bars_selected_busbar( void )
+void drawbar_scan_bars_busbar( unsigned busbar )
 {
   // Set the scan time.
   uint32_t scanTime = micros();
@@ -219,26 +419,46 @@ void drawbar_scan_bars_selected_busbar( void )
   uint8_t val_R = RegR.read();
   uint8_t val_S = RegS.read();
 
-  drawbar[0].scan(scanTime, drawbar_scan_busbar_index,
+  drawbar[0].scan(scanTime, busbar,
     (val_S & 0x20) == 0, (val_S & 0x10) == 0, 21);
-  drawbar[1].scan(scanTime, drawbar_scan_busbar_index,
+  drawbar[1].scan(scanTime, busbar,
     (val_R & 0x02) == 0, (val_R & 0x01) == 0, 22);
-  drawbar[2].scan(scanTime, drawbar_scan_busbar_index,
+  drawbar[2].scan(scanTime, busbar,
     (val_R & 0x08) == 0, (val_R & 0x04) == 0, 23);
-  drawbar[3].scan(scanTime, drawbar_scan_busbar_index,
+  drawbar[3].scan(scanTime, busbar,
     (val_R & 0x20) == 0, (val_R & 0x10) == 0, 24);
-  drawbar[4].scan(scanTime, drawbar_scan_busbar_index,
+  drawbar[4].scan(scanTime, busbar,
     (val_R & 0x80) == 0, (val_R & 0x40) == 0, 25);
-  drawbar[5].scan(scanTime, drawbar_scan_busbar_index,
+  drawbar[5].scan(scanTime, busbar,
     (val_Q & 0x40) == 0, (val_Q & 0x80) == 0, 26);
-  drawbar[6].scan(scanTime, drawbar_scan_busbar_index,
+  drawbar[6].scan(scanTime, busbar,
     (val_Q & 0x10) == 0, (val_Q & 0x20) == 0, 27);
-  drawbar[7].scan(scanTime, drawbar_scan_busbar_index,
+  drawbar[7].scan(scanTime, busbar,
     (val_Q & 0x04) == 0, (val_Q & 0x08) == 0, 28);
-  drawbar[8].scan(scanTime, drawbar_scan_busbar_index,
+  drawbar[8].scan(scanTime, busbar,
     (val_Q & 0x01) == 0, (val_Q & 0x02) == 0, 29);
 }
 
+// Queue the whole scan as one batch, the TWI ISR performs the transactions
+// back to back (in this order).  The inputs are read into the back slots, so
+// the results of the previous batch stay readable until latched.
+void scan_start_batch( void )
+{
+  static uint8_t slot = 0;
+
+  // Select the drawbar bus.
+  drawbar_select_next_busbar();
+
+  DigitalB.startOut(); // S and T
+  DigitalA.startIn();  // Q and R
+  DigitalB.startIn();  // S (and T)
+  uint8_t mask = analog_slot_mask(slot); // Analogues due in this slot
+  if (analogAlertMode)
+    mask = analog_alert_mask(mask);
+  AnalogA.startSequence(mask); // (never empty, the joystick is in every slot)
+  slot = (slot + 1) & (E_AR_SLOTS - 1);
+}
+
 // Callbacks / hook functions.
 void setLed(bool val)
 {
@@ -350,142 +570,43 @@ void switchChanged(bool state, uint8_t ccNum, uint8_t uCase)
 }
 
 bool joystickShifted = false;
-void analogChanged(bool state, uint16_t val, uint8_t ccNum, uint8_t uCase)
+void analogChanged(bool state, uint16_t val, uint8_t mapping)
 {
-  unsigned int ccVal = 127;
-  switch (uCase)
+  SAnalogMap map;
+  memcpy_P(&map, &analogMap[mapping], sizeof(map));
+  if (joystickShifted && (map.shifted != E_AM_NONE))
+    memcpy_P(&map, &analogMap[map.shifted], sizeof(map));
+
+  // Scale the span to the curve input and map it.
+  uint32_t index = ((uint32_t)val * map.scale) >> 4;
+  uint16_t out = CCurve::map(map.curve, (index < CCurve::E_CURVE_MAX) ? index : CCurve::E_CURVE_MAX);
+  uint8_t ccVal = out >> 5;
+  switch (map.out)
   {
-    case E_AUC_SIMPLE_CC:
-      if (((val & 0xfe0) >> 5) < 127)
-        ccVal = (val & 0xfe0) >> 5;
-      midiJacks.ctrlCh(ccNum, ccVal);
+    case E_AOUT_CC:
+      midiJacks.ctrlCh(map.ccA, ccVal);
       break;
-    case E_AUC_SCALED_19_16_CC:
-      if (((((val + (val >> 3) + (val >> 4))) & 0xfe0) >> 5) < 127)
-        ccVal = (((val + (val >> 3) + (val >> 4))) & 0xfe0) >> 5;
-      midiJacks.ctrlCh(ccNum, ccVal);
+    case E_AOUT_CC_BIPOLAR:
+      if (ccVal == 0) {
+        // At centre position so zero both CC's.
+        midiJacks.ctrlCh(map.ccA, 0);
+        midiJacks.ctrlCh(map.ccB, 0);
+      } else {
+        midiJacks.ctrlCh(state ? map.ccA : map.ccB, ccVal);
+      }
+      break;
+    case E_AOUT_CC_CENTRED:
+      // Half steps either side of 64, the top step goes to the end stop.
+      if (ccVal == 127)
+        midiJacks.ctrlCh(map.ccA, state ? 127 : 0);
+      else
+        midiJacks.ctrlCh(map.ccA, state ? (64 + (ccVal >> 1)) : (64 - (ccVal >> 1)));
       break;
-    case E_AUC_JOYSTICK:
-      switch (ccNum)
+    case E_AOUT_PITCH_BEND:
       {
-        case 0:
-          // X axis (forward / backwards motion)
-          ccVal = (val + (val >> 3)) >> 4;
-          if (joystickShifted) {
-            uint8_t shftVal = 64;
-            if (ccVal) {
-              if (state) {
-                if (ccVal < 127)
-                  shftVal = 64 + (ccVal >> 1);
-                else
-                  shftVal = 127;
-              } else {
-                if (ccVal < 128)
-                  shftVal = 64 - (ccVal >> 1);
-                else
-                  shftVal = 0;
-              }
-            }
-            midiJacks.ctrlCh(75, shftVal);
-          } else {
-            if (ccVal > 127) {
-              ccVal = 127;
-            }
-            if (ccVal == 0) {
-              // At centre position so zero both CC's.
-              midiJacks.ctrlCh(1, 0);
-              midiJacks.ctrlCh(2, 0);
-            } else if (state) {
-              // Forward motion - modulation
-              midiJacks.ctrlCh(1, ccVal);
-            } else {
-              // Reverse motion - breath
-              midiJacks.ctrlCh(2, ccVal);
-            }
-          }
-          break;
-        case 1:
-          // Y axis (left / right motion)
-          if (((val + (val >> 4))) < 2048)
-            ccVal = ((val + (val >> 4)));
-          else
-            ccVal = 2048;
-          if (joystickShifted) {
-            // have to shift ccVal down from 0-2047 range
-            uint8_t shftVal = 64;
-            if (ccVal) {
-              if (state) {
-                if (ccVal < 2048)
-                  shftVal = 64 + (ccVal >> 5);
-                else
-                  shftVal = 127;
-              } else {
-                if (ccVal <= 2048)
-                  shftVal = 64 - (ccVal >> 5);
-                else
-                  shftVal = 0;
-              }
-            }
-            midiJacks.ctrlCh(76, shftVal);
-          } else {
-            // Pitch bend
-            uint16_t pbVal = 8192;
-            if (ccVal) {
-              if (state) {
-                // Right (pitch up) motion
-                if (ccVal < 2048)
-                  pbVal = 8192 + (ccVal << 2);
-                else
-                  pbVal = 16383;
-              } else {
-                // Left (pitch down) motion
-                if (ccVal <= 2048)
-                  pbVal = 8192 - (ccVal << 2);
-                else
-                  pbVal = 0;
-              }
-            }
-            midiJacks.pitchBend(pbVal);
-          }
-          break;
-        case 2:
-          // Z axis (twist CW / CCW motion)
-          ccVal = (val + (val >> 3)) >> 4;
-          if (joystickShifted) {
-            uint8_t shftVal = 64;
-            if (ccVal) {
-              if (state) {
-                if (ccVal < 127)
-                  shftVal = 64 + (ccVal >> 1);
-                else
-                  shftVal = 127;
-              } else {
-                if (ccVal < 128)
-                  shftVal = 64 - (ccVal >> 1);
-                else
-                  shftVal = 0;
-              }
-            }
-            midiJacks.ctrlCh(77, shftVal);
-          } else {
-            if (ccVal > 127) {
-              ccVal = 127;
-            }
-            if (ccVal == 0) {
-              // At centre position so zero both CC's.
-              midiJacks.ctrlCh(12, 0);
-              midiJacks.ctrlCh(13, 0);
-            } else if (state) {
-              // CW motion
-              midiJacks.ctrlCh(12, ccVal);
-            } else {
-              // CCW motion
-              midiJacks.ctrlCh(13, ccVal);
-            }
-          }
-          break;
-        default:
-          break;
+        // Full deflection reaches the end stops.
+        uint16_t offset = (out << 1) + (out >> 11);
+        midiJacks.pitchBend(state ? (8192 + offset) : ((offset < 8191) ? (8192 - offset) : 0));
       }
       break;
     default:
@@ -493,6 +614,69 @@ void analogChanged(bool state, uint16_t val, uint8_t ccNum, uint8_t uCase)
   }
 }
 
+// Pack a 14 bit value into two SysEx data bytes (MS first, saturating).
+static uint8_t *sysExPut14(uint8_t *buf, uint16_t val)
+{
+  if (val > 0x3fff)
+    val = 0x3fff;
+  *(buf++) = (val >> 7) & 0x7f;
+  *(buf++) = val & 0x7f;
+  return buf;
+}
+
+// Report the I2C clock, on a change and along with the health counters.
+void sendI2cSpeed(void)
+{
+  // clock (kHz), errors in the last window, window size (transactions)
+  uint8_t msg[8];
+  uint8_t *p = msg;
+  *(p++) = SYSEX_ID;
+  *(p++) = E_SYSX_I2C_SPEED;
+  p = sysExPut14(p, twi_clock() / 1000);
+  p = sysExPut14(p, twi_window_errors());
+  p = sysExPut14(p, TWI_SPEED_WINDOW);
+  midiJacks.sendSysEx(msg, p - msg);
+}
+
+// Report the I2C health counters when they change (at most once per interval).
+void sendI2cHealth(uint32_t rTime)
+{
+  const uint32_t reportInterval = 1000000; // us
+  static uint32_t lastReport = 0;
+  static uint16_t lastTotal = 0;
+
+  if ((rTime - lastReport) < reportInterval)
+    return;
+
+  uint16_t total = 0;
+  const STwiStats *stats;
+  for (uint8_t i = 0; (stats = twi_stats(i)) != NULL; i++) {
+    total += stats->nack + stats->arb_lost + stats->bus_error + stats->timeout +
+      stats->recovery + stats->data_error;
+  }
+  if (total == lastTotal)
+    return;
+  lastTotal = total;
+  lastReport = rTime;
+
+  for (uint8_t i = 0; (stats = twi_stats(i)) != NULL; i++) {
+    // address, nack, arb lost, bus error, timeout, recovery, data error
+    uint8_t msg[15];
+    uint8_t *p = msg;
+    *(p++) = SYSEX_ID;
+    *(p++) = E_SYSX_I2C_HEALTH;
+    *(p++) = stats->address;
+    p = sysExPut14(p, stats->nack);
+    p = sysExPut14(p, stats->arb_lost);
+    p = sysExPut14(p, stats->bus_error);
+    p = sysExPut14(p, stats->timeout);
+    p = sysExPut14(p, stats->recovery);
+    p = sysExPut14(p, stats->data_error);
+    midiJacks.sendSysEx(msg, p - msg);
+  }
+  sendI2cSpeed();
+}
+
 // Handle drawbar change
 void drawbarChanged(uint8_t val, uint8_t ccNum, uint8_t uCase)
 {
@@ -526,17 +710,15 @@ void setup()
   twi_init(16000000UL, wireClockFrequency);
 
   // Probe and initialize the CAT9555 expansion ports.
-  RegQ.begin();
-  RegR.begin();
-  RegS.begin();
-  RegT.begin();
+  DigitalA.begin();
+  DigitalB.begin();
 
   // Probe and initialize the AD7997 analog ports.
-  AnalogA.begin();
+  AnalogA.begin(analogAlertMode);
 
   // Initialize the filters.
   for (uint8_t index = 0; index < 8; index++) {
-    analogFilters[index].begin(AnalogA.read(index));
+    analog_filter(index).begin(index, AnalogA.read(index));
   }
 
   // Read in so we can check the DIP switches at startup.
@@ -544,7 +726,7 @@ void setup()
   debug_mode = true;
 #else
   // DIP SW3 selects debug mode for Aux MCU.
-  RegT.syncIn();
+  DigitalB.syncIn();
   debug_mode = ((RegT.read() & 0x01) == 0);
 #endif
 
@@ -598,6 +780,7 @@ void loop()
     } else {
       // Active sense
       midiJacks.activeSense();
+      sendI2cHealth(currentMicros);
     }
 
     // Flush output state to LED
@@ -607,69 +790,45 @@ void loop()
   enum e_ScanStates
   {
     E_SCAN_START,
-    E_SCAN_WRITING_DRAWBAR_BUS_SELECT_S,
-    E_SCAN_WRITING_DRAWBAR_BUS_SELECT_T,
-    E_SCAN_READING_DRAWBAR_INPUT_Q,
-    E_SCAN_READING_DRAWBAR_INPUT_R,
-    E_SCAN_READING_DRAWBAR_INPUT_S,
-    E_SCAN_MISC_SWITCHES,
-    E_SCAN_READING_ANALOGS,
+    E_SCAN_WAITING_BATCH,
   };
   static enum e_ScanStates state = E_SCAN_START;
 
+  // The scan is pipelined - as soon as a batch completes its results are
+  // latched and the next batch is queued, so the I2C transfers of one cycle
+  // overlap the processing of the previous one.
+  unsigned scannedBusbar;
+  bool analogLatched;
   switch (state)
   {
     case E_SCAN_START:
-      // Select the drawbar bus.
-      drawbar_select_next_busbar();
-
-      RegS.startOut();
-      state = E_SCAN_WRITING_DRAWBAR_BUS_SELECT_S;
-      break;
-
-    case E_SCAN_WRITING_DRAWBAR_BUS_SELECT_S:
-      // Wait until done.
-      if (RegS.isBusy()) break;
-
-      RegT.startOut();
-      state = E_SCAN_WRITING_DRAWBAR_BUS_SELECT_T;
+      scan_start_batch();
+      state = E_SCAN_WAITING_BATCH;
       break;
 
-    case E_SCAN_WRITING_DRAWBAR_BUS_SELECT_T:
+    case E_SCAN_WAITING_BATCH:
       // Wait until done.
-      if (RegT.isBusy()) break;
+      if (!twi_batch_done()) break;
 
-      RegQ.startIn();
-      state = E_SCAN_READING_DRAWBAR_INPUT_Q;
-      break;
-
-    case E_SCAN_READING_DRAWBAR_INPUT_Q:
-      // Wait until done.
-      if (RegQ.isBusy()) break;
-
-      RegR.startIn();
-      state = E_SCAN_READING_DRAWBAR_INPUT_R;
-      break;
-
-    case E_SCAN_READING_DRAWBAR_INPUT_R:
-      // Wait until done.
-      if (RegR.isBusy()) break;
-
-      RegS.startIn();
-      state = E_SCAN_READING_DRAWBAR_INPUT_S;
-      break;
+      // Adapt the I2C clock to the error rate (only changes between batches).
+      if (twi_speed_update())
+        sendI2cSpeed();
 
-    case E_SCAN_READING_DRAWBAR_INPUT_S:
-      // Wait until done.
-      if (RegS.isBusy()) break;
+      // Take the results, then get the next batch going on the next busbar.
+      DigitalA.latchIn();
+      DigitalB.latchIn();
+      analogLatched = AnalogA.latch();
+      scannedBusbar = drawbar_scan_busbar_index;
+      if (drawbar_scan_busbar_index < 8) {
+        drawbar_scan_busbar_index++;
+      } else {
+        drawbar_scan_busbar_index = 0;
+      }
+      scan_start_batch();
 
       // Process the drawbar inputs read.
-      drawbar_scan_bars_selected_busbar();
-
-      state = E_SCAN_MISC_SWITCHES;
-      break;
+      drawbar_scan_bars_busbar(scannedBusbar);
 
-    case E_SCAN_MISC_SWITCHES:
       scan_misc_switches( currentMicros );
 
       if (rotaryBrakeStart) {
@@ -681,37 +840,33 @@ void loop()
         }
       }
 
-      analog_ch_index = 0;
-      AnalogA.start(analog_ch_index);
-      state = E_SCAN_READING_ANALOGS;
-      break;
-
-    case  E_SCAN_READING_ANALOGS:
-      // Wait until done.
-      if (AnalogA.isBusy()) break;
-
-      scan_analogs(analog_ch_index, currentMicros);
-
-      if (analog_ch_index < 7) {
-        // start for the next analog.
-        AnalogA.start(++analog_ch_index);
-        break;
+      if (analogLatched) {
+        // A failed sequence is skipped rather than filtering its stale samples
+        // again (they would count towards validating a value not re-read).
+        // Alert status is only worth a read when a result was flagged.
+        uint8_t alerts = 0;
+        if (analogAlertMode && AnalogA.alertFlagged()) {
+          alerts = AnalogA.syncAlerts();
+        }
+        uint8_t sampled = 0;
+        for (uint8_t index = 0; index < CAd7997::E_NUM_PORTS; index++) {
+          if (AnalogA.sampled(index))
+            sampled |= 1 << index;
+        }
+        scan_analogs(sampled, currentMicros, alerts);
       }
 
       // Completed.
-      if (analogFilters[5].atOrigin() && analogFilters[6].atOrigin() && analogFilters[7].atOrigin()) {
+      if (controlFilters.atOrigin(5) && controlFilters.atOrigin(6) && controlFilters.atOrigin(7)) {
         // We only allow the joystick switch to shift / unshift while joystick is positioned at origin.
         joystickShifted = joystickButton.switchState();
       }
-
-      // Syncup for next time.
-      if (drawbar_scan_busbar_index < 8) {
-        drawbar_scan_busbar_index++;
-      } else {
-        drawbar_scan_busbar_index = 0;
-      }
-      state = E_SCAN_START;
       break;
   }
+
+  if (debug_mode) {
+    // Trace records go to the Main MCU, framed so it can pick them out.
+    trace.drain(Serial);
+  }
 }
 
@@ -43,11 +43,59 @@ static volatile uint8_t slave_default_msg;
 static void (*slave_transfer_request_callback)(uint8_t xtype, volatile uint8_t **ptrptr, volatile uint8_t *szptr);
 static void (*slave_transfer_complete_callback)(uint8_t xtype, uint8_t count);
 static volatile uint8_t bit_bucket;
+static struct STwiXfer * volatile master_xfer;
+static struct STwiXfer *master_queue[TWI_QUEUE_SIZE];
+static volatile uint8_t master_queue_head;
+static volatile uint8_t master_queue_tail;
+static struct STwiXfer master_single_xfer;
+static volatile uint32_t master_start_us;
+static volatile uint16_t master_xfer_count;
+// Bus speed candidates, fastest first (TWBR with no prescaler, at 16MHz
+// these are 800kHz, 615kHz, 400kHz, 200kHz and 100kHz).
+static const uint8_t speed_twbr[] = { 2, 5, 12, 32, 72 };
+#define TWI_SPEED_LEVELS				(sizeof(speed_twbr) / sizeof(speed_twbr[0]))
+static uint32_t speed_fosc;
+static uint8_t speed_level;
+static uint8_t speed_fastest;
+static uint16_t speed_window_start;
+static volatile uint16_t speed_errors;
+static uint16_t speed_window_errors;
+static uint16_t speed_clean_windows;
+static uint16_t speed_up_windows;
+static struct STwiStats device_stats[TWI_MAX_DEVICES];
+
+#define TWI_STAT_INC(field) \
+	{ struct STwiStats *s = stats_for(master_sla); if (s && (s->field != 0xffff)) s->field++; }
+
+// Count an error against the device and the current speed window
+#define TWI_ERROR_INC(field) \
+	{ TWI_STAT_INC(field); if (speed_errors != 0xffff) speed_errors++; }
 
 #ifndef cbi
 #define cbi(sfr, bit) (_SFR_BYTE(sfr) &= ~_BV(bit))
 #endif
 
+/////////////////////////////////////////////////////////////////////
+// stats_for
+//
+// Find (or allocate) the health counters for a device
+/////////////////////////////////////////////////////////////////////
+static struct STwiStats *stats_for(uint8_t address)
+{
+	for (uint8_t i = 0; i < TWI_MAX_DEVICES; i++)
+	{
+		if (device_stats[i].address == address)
+			return &device_stats[i];
+		if (device_stats[i].address == 0)
+		{
+			// Unused entry so claim it
+			device_stats[i].address = address;
+			return &device_stats[i];
+		}
+	}
+	return NULL;
+}
+
 /////////////////////////////////////////////////////////////////////
 // twi_init
 //
@@ -67,7 +115,17 @@ void twi_init(uint32_t fosc, uint32_t twi_clk_speed)
 //	TWSR = 0;
 //#endif
 
-	TWBR = ((fosc / twi_clk_speed) - 16) / 2;
+	// Start at the fastest candidate that is no faster than requested
+	uint8_t twbr = ((fosc / twi_clk_speed) - 16) / 2;
+	speed_fosc = fosc;
+	speed_fastest = 0;
+	while ((speed_fastest < (TWI_SPEED_LEVELS - 1)) && (speed_twbr[speed_fastest] < twbr))
+		speed_fastest++;
+	speed_level = speed_fastest;
+	speed_errors = 0;
+	speed_clean_windows = 0;
+	speed_up_windows = TWI_SPEED_UP_WINDOWS;
+	TWBR = speed_twbr[speed_level];
 
 	// Default setup is ready to write nothing from nowhere to nobody
 	master_sla = 0;
@@ -101,6 +159,9 @@ void twi_init(uint32_t fosc, uint32_t twi_clk_speed)
 	// general call or slave tx but must default to receive for some
 	// of the "switch" block fall throughs to properly work.
 	slave_transfer_type = TWI_SLAVE_RX;
+	master_xfer = NULL;
+	master_queue_head = 0;
+	master_queue_tail = 0;
 
   // Enable TWI module, acks, and interrupt
   TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
@@ -188,59 +249,114 @@ void twi_slave_setup(uint8_t slave_address, uint8_t general_call,
 }
 
 /////////////////////////////////////////////////////////////////////
-// twi_initiate_transaction
+// master_load
 //
-// Read bytes from a TWI peripheral
+// Set up the master state machine for a transaction descriptor
 /////////////////////////////////////////////////////////////////////
-int8_t twi_initiate_transaction(uint8_t address, uint8_t *data_wr,
-	uint8_t bytes_wr, uint8_t *data_rd, uint8_t bytes_rd)
+static void master_load(struct STwiXfer *xfer)
+{
+	master_xfer = xfer;
+	master_sla = xfer->address;
+	master_data_rd_ptr = xfer->data_rd;
+	master_rd_bytes = xfer->bytes_rd;
+	master_data_wr_ptr = xfer->data_wr;
+	master_wr_bytes = xfer->bytes_wr;
+	// Validated when queued so a write (if any) always goes first
+	master_ddr = master_wr_bytes ? TW_WRITE : TW_READ;
+	master_arb_retry_cnt = 0;
+	master_sla_retry_cnt = 0;
+	master_start_us = micros();
+}
+
+/////////////////////////////////////////////////////////////////////
+// master_complete
+//
+// Complete the current master transaction (called from the ISR) and
+// load the next queued one.  Returns the TWCR start bit to merge with
+// the stop so the next transaction follows without a loop() round trip.
+/////////////////////////////////////////////////////////////////////
+static uint8_t master_complete(boolean ok)
+{
+	struct STwiXfer *xfer = master_xfer;
+
+	master_response_ok = ok;
+	master_xfer_count++;
+	xfer->status = ok ? TWI_XFER_DONE : TWI_XFER_FAILED;
+	if (xfer->complete_callback)
+		(*(xfer->complete_callback))(xfer);
+
+	if (master_queue_tail != master_queue_head)
+	{
+		// Chain the next transaction
+		master_load(master_queue[master_queue_tail]);
+		master_queue_tail = (master_queue_tail + 1) & (TWI_QUEUE_SIZE - 1);
+		return (1 << TWSTA);
+	}
+
+	// Bus no longer busy
+	master_busy = false;
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////
+// twi_queue_transaction
+//
+// Queue a transaction to a TWI peripheral.  Queued transactions are
+// performed back to back by the ISR.  Not to be called from an ISR.
+/////////////////////////////////////////////////////////////////////
+int8_t twi_queue_transaction(struct STwiXfer *xfer)
 {
+	if (!(xfer->bytes_wr && !(xfer->bytes_rd && !xfer->address)) &&
+		!(xfer->bytes_rd && xfer->address))
+	{
+		// Invalid request
+		//  - request nothing send or receive
+		//  - trying to read during a general call
+		return TWI_ERR_API_PARM_INVALID;
+	}
+	xfer->status = TWI_XFER_QUEUED;
+
 	noInterrupts(); // protect atomic operation
 
-	// Bus is busy so wait and then try again
-	while (master_busy)
+	if (master_busy)
 	{
-		// Allow for interuption but ensure that test and exit
-		// from loop is atomic
+		// Transaction in progress so add to the queue
+		uint8_t next = (master_queue_head + 1) & (TWI_QUEUE_SIZE - 1);
+		if (next == master_queue_tail)
+		{
+			interrupts();
+			return TWI_ERR_QUEUE_FULL;
+		}
+		master_queue[master_queue_head] = xfer;
+		master_queue_head = next;
 		interrupts();
-		noInterrupts();
+		return 0;
 	}
 
 	// Reserve bus as busy by us
 	master_busy = true;
-	master_response_ok = false;
-//	bus_error = false;
 
+	uint32_t start = micros();
 	while (TWCR & (1 << TWSTO))
 	{
 		// Allow for interuption but ensure that test and exit from
 		// loop is atomic
 		interrupts();
+		if ((micros() - start) > TWI_TIMEOUT_US)
+		{
+			// Stop condition never completed - bus is stuck
+			master_xfer = xfer;
+			master_sla = xfer->address;
+			TWI_ERROR_INC(timeout);
+			// Note: This fails the transaction being queued as well.
+			twi_recover();
+			return TWI_ERR_BUS_TIMEOUT;
+		}
 		noInterrupts();
 	}
 
-	master_sla = address;
-	master_data_rd_ptr = data_rd;
-	master_rd_bytes = bytes_rd;
-	master_data_wr_ptr = data_wr;
-	master_wr_bytes = bytes_wr;
-	if (master_wr_bytes && !(master_rd_bytes && !master_sla))
-		master_ddr = TW_WRITE;
-	else if (master_rd_bytes && master_sla)
-		master_ddr = TW_READ;
-	else
-	{
-		// Invalid request
-		//  - request nothing send or receive
-		//  - trying to read during a general call
-		master_busy = false;
-		interrupts();
-		return TWI_ERR_API_PARM_INVALID;
-	}
+	master_load(xfer);
 
-	master_arb_retry_cnt = 0;
-	master_sla_retry_cnt = 0;
-	
 	// Generate start condition, the remainder of the transfer is
 	// interrupt driven and will be performed in the background
 	if (!master_blocked)
@@ -251,13 +367,34 @@ int8_t twi_initiate_transaction(uint8_t address, uint8_t *data_wr,
 		// we will enable the start operation.
 		TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
 	}
-	
+
 	interrupts();
 
-  // No error
+	// No error
 	return 0;
 }
 
+/////////////////////////////////////////////////////////////////////
+// twi_initiate_transaction
+//
+// Write and / or read bytes to / from a TWI peripheral
+/////////////////////////////////////////////////////////////////////
+int8_t twi_initiate_transaction(uint8_t address, uint8_t *data_wr,
+	uint8_t bytes_wr, uint8_t *data_rd, uint8_t bytes_rd)
+{
+	// Bus is busy so wait until anything queued is done (this also
+	// frees up the descriptor used for single transactions)
+	twi_wait_until_master_ready();
+
+	master_single_xfer.address = address;
+	master_single_xfer.data_wr = data_wr;
+	master_single_xfer.bytes_wr = bytes_wr;
+	master_single_xfer.data_rd = data_rd;
+	master_single_xfer.bytes_rd = bytes_rd;
+	master_single_xfer.complete_callback = NULL;
+	return twi_queue_transaction(&master_single_xfer);
+}
+
 /////////////////////////////////////////////////////////////////////
 // twi_initiate_write
 //
@@ -291,16 +428,41 @@ boolean twi_busy(void)
 	return master_busy;
 }
 
+/////////////////////////////////////////////////////////////////////
+// twi_batch_done
+//
+// Check if all queued transactions have been performed.
+/////////////////////////////////////////////////////////////////////
+boolean twi_batch_done(void)
+{
+	if (master_busy)
+	{
+		// Don't wait forever on a stuck bus
+		uint32_t start;
+		noInterrupts();
+		start = master_start_us;
+		interrupts();
+		if (master_busy && ((micros() - start) > TWI_TIMEOUT_US))
+		{
+			TWI_ERROR_INC(timeout);
+			twi_recover();
+		}
+	}
+	return !master_busy;
+}
+
 /////////////////////////////////////////////////////////////////////
 // twi_wait_until_master_ready
 //
-// Wait loop.
+// Wait loop.  Returns whether the last transaction succeeded.
 /////////////////////////////////////////////////////////////////////
-void twi_wait_until_master_ready(void)
+boolean twi_wait_until_master_ready(void)
 {
-	while (master_busy)
+	// Bounded by the transaction timeout (a stuck bus is recovered)
+	while (!twi_batch_done())
 	{
 	}
+	return master_response_ok;
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -313,6 +475,171 @@ boolean twi_response(void)
 	return master_response_ok;
 }
 
+/////////////////////////////////////////////////////////////////////
+// twi_recover
+//
+// Free a stuck bus (a slave holding SDA low after a glitch or reset
+// mid-transfer) by clocking it out and generating a stop condition,
+// then restart the TWI.  Anything in progress or queued fails.  Returns
+// false if SDA is still held low (the bus could not be freed).
+/////////////////////////////////////////////////////////////////////
+boolean twi_recover(void)
+{
+	noInterrupts();
+	if (master_busy)
+	{
+		TWI_STAT_INC(recovery);
+	}
+	// Take the pins back from the TWI module
+	TWCR = 0;
+	interrupts();
+
+	// Open drain by hand - the port bits stay low, so a pin pulls the
+	// line low as an output and releases it to the pull-up as an input
+	pinMode(SDA, INPUT);
+	pinMode(SCL, INPUT);
+	digitalWrite(SDA, 0);
+	digitalWrite(SCL, 0);
+	delayMicroseconds(5);
+
+	// Clock until the slave lets go of SDA (at most a byte and an ack)
+	for (uint8_t i = 0; (i < 9) && !digitalRead(SDA); i++)
+	{
+		pinMode(SCL, OUTPUT);
+		delayMicroseconds(5);
+		pinMode(SCL, INPUT);
+		delayMicroseconds(5);
+	}
+
+	boolean freed = digitalRead(SDA);
+	if (freed)
+	{
+		// Stop condition - SDA low to high while SCL is high
+		pinMode(SDA, OUTPUT);
+		delayMicroseconds(5);
+		pinMode(SDA, INPUT);
+		delayMicroseconds(5);
+	}
+	// Internal pull-ups back on, as twi_init left them
+	digitalWrite(SDA, 1);
+	digitalWrite(SCL, 1);
+
+	noInterrupts();
+	// Fail the transaction in progress and everything queued behind it
+	while (master_busy && master_complete(false))
+	{
+	}
+	master_busy = false;
+	master_blocked = false;
+	slave_transfer_type = TWI_SLAVE_RX;
+
+	// Enable TWI module, acks, and interrupt
+	TWAR = slave_sla;
+	TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
+	interrupts();
+	return freed;
+}
+
+/////////////////////////////////////////////////////////////////////
+// twi_count_data_error
+//
+// Device drivers report data that failed their own checks
+/////////////////////////////////////////////////////////////////////
+void twi_count_data_error(uint8_t address)
+{
+	noInterrupts();
+	struct STwiStats *s = stats_for(address);
+	if (s && (s->data_error != 0xffff))
+		s->data_error++;
+	if (speed_errors != 0xffff)
+		speed_errors++;
+	interrupts();
+}
+
+/////////////////////////////////////////////////////////////////////
+// twi_stats
+//
+// Get the health counters, by index (NULL past the last device seen)
+/////////////////////////////////////////////////////////////////////
+const struct STwiStats *twi_stats(uint8_t index)
+{
+	if ((index >= TWI_MAX_DEVICES) || (device_stats[index].address == 0))
+		return NULL;
+	return &device_stats[index];
+}
+
+/////////////////////////////////////////////////////////////////////
+// twi_speed_update
+//
+// Bus speed controller, call regularly while the bus is idle.  Steps
+// down to a slower clock when a window of transactions sees errors,
+// and back up after enough clean windows.  Returns true on a change.
+/////////////////////////////////////////////////////////////////////
+boolean twi_speed_update(void)
+{
+	uint16_t count;
+	noInterrupts();
+	count = master_xfer_count;
+	interrupts();
+	if (master_busy || ((uint16_t)(count - speed_window_start) < TWI_SPEED_WINDOW))
+		return false;
+	speed_window_start = count;
+
+	// Errors of any kind, on any device, during the window (the device
+	// counters saturate so can't be used for this)
+	noInterrupts();
+	speed_window_errors = speed_errors;
+	speed_errors = 0;
+	interrupts();
+
+	if (speed_window_errors >= TWI_SPEED_MAX_ERRORS)
+	{
+		speed_clean_windows = 0;
+		if (speed_level >= (TWI_SPEED_LEVELS - 1))
+			return false;
+		// Slow down, and be slower to try the faster clock again
+		speed_level++;
+		if (speed_up_windows < TWI_SPEED_UP_WINDOWS_MAX)
+			speed_up_windows <<= 1;
+	}
+	else if (speed_window_errors == 0)
+	{
+		if ((++speed_clean_windows < speed_up_windows) || (speed_level <= speed_fastest))
+			return false;
+		// Cautiously try the next faster clock
+		speed_clean_windows = 0;
+		speed_level--;
+	}
+	else
+	{
+		speed_clean_windows = 0;
+		return false;
+	}
+
+	TWBR = speed_twbr[speed_level];
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////
+// twi_clock
+//
+// Get the bus clock in use (Hz)
+/////////////////////////////////////////////////////////////////////
+uint32_t twi_clock(void)
+{
+	return speed_fosc / (16 + (2 * (uint32_t)speed_twbr[speed_level]));
+}
+
+/////////////////////////////////////////////////////////////////////
+// twi_window_errors
+//
+// Get the number of errors in the last speed control window
+/////////////////////////////////////////////////////////////////////
+uint16_t twi_window_errors(void)
+{
+	return speed_window_errors;
+}
+
 /////////////////////////////////////////////////////////////////////
 // SIGNAL SIG_2WIRE_SERIAL
 //
@@ -322,6 +649,8 @@ ISR(TWI_vect)
 {
 	// Mask out prescaler bits to get TWI status
 	uint8_t TWI_status = TWSR & TW_STATUS_MASK;
+	boolean xfer_ok = false;
+	uint8_t chain = 0;
 	
 	switch(TWI_status)
 	{
@@ -350,6 +679,7 @@ ISR(TWI_vect)
 	case TW_MT_SLA_NACK:	// Slave didn't acknowledge address,
 	case TW_MR_SLA_NACK:
 		// this may mean that the slave is disconnected
+		TWI_ERROR_INC(nack);
 		master_sla_retry_cnt++;
 		if (master_sla_retry_cnt > (master_sla_number_of_attempts - 1))
 		{
@@ -357,10 +687,9 @@ ISR(TWI_vect)
 			// Affect any pending change in slave address
 			if (TWAR != slave_sla)
 				TWAR = slave_sla;
-			// Generate stop condition
-			TWCR |= (1 << TWINT) | (1 << TWSTO) | (1 << TWEA);
-			// Bus no longer busy
-			master_busy = false;
+			// Generate stop condition (and start of any queued transaction)
+			chain = master_complete(false);
+			TWCR |= (1 << TWINT) | (1 << TWSTO) | (1 << TWEA) | chain;
 		}
 		else
 		{
@@ -395,12 +724,10 @@ ISR(TWI_vect)
 			// Affect any pending change in slave address
 			if (TWAR != slave_sla)
 				TWAR = slave_sla;
-			// Generate the stop condition
-			TWCR |= (1 << TWSTO) | (1 << TWINT) | (1 << TWEA);
-			// Bus no longer busy
-			master_busy = false;
 			// Response has been received
-			master_response_ok = true;
+			chain = master_complete(true);
+			// Generate the stop condition (and start of any queued transaction)
+			TWCR |= (1 << TWSTO) | (1 << TWINT) | (1 << TWEA) | chain;
 		}
 		break;
 
@@ -424,17 +751,20 @@ ISR(TWI_vect)
 			}
 			// Otherwise end of normal transmit
 			// Response has been received
-			master_response_ok = true;
+			xfer_ok = true;
+		}
+		else
+		{
+			TWI_ERROR_INC(nack);
 		}
 
 		// Affect any pending change in slave address
 		if (TWAR != slave_sla)
 			TWAR = slave_sla;
 
-		// Send stop condition
-		TWCR |= (1 << TWINT) | (1 << TWSTO) | (1 << TWEA);
-		// Bus no longer busy
-		master_busy = false;
+		// Send stop condition (and start of any queued transaction)
+		chain = master_complete(xfer_ok);
+		TWCR |= (1 << TWINT) | (1 << TWSTO) | (1 << TWEA) | chain;
 		break;
 
 	case TW_MR_SLA_ACK:		// Slave acknowledged address
@@ -468,16 +798,15 @@ ISR(TWI_vect)
 		if (TWAR != slave_sla)
 			TWAR = slave_sla;
 
-		// Generate stop condition
-		TWCR |= (1 << TWSTO) | (1 << TWINT) | (1 << TWEA);
-		// Bus no longer busy
-		master_busy = false;
 		// Response has been received
-		master_response_ok = true;
+		chain = master_complete(true);
+		// Generate stop condition (and start of any queued transaction)
+		TWCR |= (1 << TWSTO) | (1 << TWINT) | (1 << TWEA) | chain;
 		break;
 
 	case TW_MT_ARB_LOST: 	// We lost to another master during SLA+R/W
 	//case TW_MR_ARB_LOST: 	- redundant as it is same value as TW_MT_ARB_LOST
+		TWI_ERROR_INC(arb_lost);
 		// Affect any pending change in slave address
 		if (TWAR != slave_sla)
 			TWAR = slave_sla;
@@ -487,10 +816,9 @@ ISR(TWI_vect)
 		{
 			// It is likely that bus is overloaded with activity or multiple
 			// masters erroneously have the same address (or competing roles).
-			// Generate stop condition
-			TWCR |= (1 << TWSTO) | (1 << TWINT) | (1 << TWEA);
-			// Bus no longer busy
-			master_busy = false;
+			// Generate stop condition (and start of any queued transaction)
+			chain = master_complete(false);
+			TWCR |= (1 << TWSTO) | (1 << TWINT) | (1 << TWEA) | chain;
 		}
 		else
 		{
@@ -661,23 +989,23 @@ ISR(TWI_vect)
 			}
 			// It is likely that bus is overloaded with activity or multiple
 			// masters erroneously have the same address (or competing roles).
-			// Bus no longer busy
-			master_busy = false;
+			// Give up on it (and start any queued transaction instead)
+			chain = master_complete(false);
 		}
 
 		// Go back to slave monitoring mode
-		TWCR |= (1 << TWEA) | (1 << TWINT);
+		TWCR |= (1 << TWEA) | (1 << TWINT) | chain;
 		break;
 
 	case TW_BUS_ERROR:
 	default: // Unhandled state - error
 		if (master_busy)
 		{
-			// Generate stop condition
-			TWCR |= (1 << TWINT) | (1 << TWSTO);
-			// Bus no longer busy
-			master_busy = false;
+			TWI_ERROR_INC(bus_error);
 			master_blocked = false;
+			// Generate stop condition (and start of any queued transaction)
+			chain = master_complete(false);
+			TWCR |= (1 << TWINT) | (1 << TWSTO) | chain;
 		}
 		bus_error = TWI_status;
 		break;
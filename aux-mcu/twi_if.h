@@ -17,6 +17,56 @@
 #define TWI_GENERAL_CALL			2
 
 #define TWI_ERR_API_PARM_INVALID		(-1)
+#define TWI_ERR_QUEUE_FULL				(-2)
+#define TWI_ERR_BUS_TIMEOUT			(-3)
+
+#define TWI_XFER_QUEUED				0
+#define TWI_XFER_DONE					1
+#define TWI_XFER_FAILED				2
+
+// Number of transactions that can be queued (power of 2).
+#define TWI_QUEUE_SIZE					16
+
+// Longest a transaction may take before the bus is recovered (us).
+#define TWI_TIMEOUT_US					2000
+
+// Number of devices health counters are kept for.
+#define TWI_MAX_DEVICES				4
+
+// Bus speed control - errors (of any kind) allowed per window of
+// transactions before stepping down to the next slower clock, and the
+// number of clean windows before trying the next faster one again (this
+// doubles each time a step down follows).
+#define TWI_SPEED_WINDOW				256
+#define TWI_SPEED_MAX_ERRORS			2
+#define TWI_SPEED_UP_WINDOWS			64
+#define TWI_SPEED_UP_WINDOWS_MAX		4096
+
+// Master transaction descriptor.  The descriptor and the data it points at
+// must stay valid until the transaction completes (owned by the caller).
+struct STwiXfer
+{
+	uint8_t address;
+	uint8_t *data_wr;
+	uint8_t bytes_wr;
+	uint8_t *data_rd;
+	uint8_t bytes_rd;
+	// Called from the TWI ISR on completion (optional, keep it short).
+	void (*complete_callback)(struct STwiXfer *xfer);
+	volatile uint8_t status;
+};
+
+// Per-device health counters (saturating).
+struct STwiStats
+{
+	uint8_t address;
+	uint16_t nack;
+	uint16_t arb_lost;
+	uint16_t bus_error;
+	uint16_t timeout;
+	uint16_t recovery;
+	uint16_t data_error; // Reported by the device driver (bad data read)
+};
 
 // Prototypes
 void twi_init(uint32_t fosc = 16000000UL, uint32_t twi_clk_speed = 400000UL);
@@ -30,11 +80,19 @@ void twi_slave_setup(uint8_t slave_address, uint8_t general_call,
 	);
 int8_t twi_initiate_transaction(uint8_t address, uint8_t *data_wr, uint8_t bytes_wr,
 	uint8_t *data_rd, uint8_t bytes_rd);
+int8_t twi_queue_transaction(struct STwiXfer *xfer);
+boolean twi_batch_done(void);
 int8_t twi_initiate_write(uint8_t address, uint8_t *data, uint8_t bytes);
 int8_t twi_initiate_read(uint8_t address, uint8_t *data, uint8_t bytes);
 boolean twi_busy(void);
-void twi_wait_until_master_ready(void);
+boolean twi_wait_until_master_ready(void);
 boolean twi_response(void);
+boolean twi_recover(void);
+void twi_count_data_error(uint8_t address);
+const struct STwiStats *twi_stats(uint8_t index);
+boolean twi_speed_update(void);
+uint32_t twi_clock(void);
+uint16_t twi_window_errors(void);
 
 #endif
 
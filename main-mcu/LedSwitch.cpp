@@ -10,8 +10,8 @@
 #include "Arduino.h"
 
 #include "LedSwitch.h"
+#include "Trace.h"
 
-extern bool debug_mode;
 void switchChanged(bool state, uint8_t ccNum, uint8_t uCase);
 
 CSwitch::CSwitch(const char *switchName) :
@@ -90,24 +90,11 @@ void CSwitch::scan(uint32_t sTime, bool state, uint8_t ccNum, uint8_t uCase)
 void CSwitch::switchOn(uint8_t ccNum, uint8_t uCase)
 {
   switchChanged(true, ccNum, uCase);
-  if (debug_mode) {
-    char mbuffer[12];
-    Serial.print(F("Switch: "));
-    strncpy_P(mbuffer, m_switchName, sizeof(mbuffer) - 1);
-    Serial.print(mbuffer);
-    Serial.println(F(" on"));
-  }
+  trace.record(E_TR_SWITCH, 1, m_switchName);
 }
 
 void CSwitch::switchOff(uint8_t ccNum, uint8_t uCase)
 {
   switchChanged(false, ccNum, uCase);
-  if (debug_mode) {
-    char mbuffer[12];
-    Serial.print(F("Switch: "));
-    strncpy_P(mbuffer, m_switchName, sizeof(mbuffer) - 1);
-    Serial.print(mbuffer);
-    Serial.println(F(" off"));
-  }
+  trace.record(E_TR_SWITCH, 0, m_switchName);
 }
-
@@ -0,0 +1,106 @@
+/////////////////////////////////////////////////////////////////////
+// Per-stage loop profiler using a free running hardware timer.
+//
+// Copyright 2018, Darcy Watkins
+// All Rights Reserved.
+//
+// Available under Mozilla Public License Version 2.0
+// See the LICENSE file for license terms.
+/////////////////////////////////////////////////////////////////////
+#ifndef __LOOPPROFILER_H
+#define __LOOPPROFILER_H
+
+#include "Arduino.h"
+
+// Timer 4 is taken over as a free running counter at F_CPU / 8 (0.5us per tick
+// at 16MHz, wrapping at 32.7ms).  Its PWM outputs (pins 6, 7 and 8) are used as
+// switch matrix inputs, so nothing else on the Main MCU needs it.
+template<uint8_t NumStages>
+class CLoopProfiler
+{
+  public:
+    enum properties
+    {
+      E_TICKS_PER_US = 2,
+      E_NUM_BINS = 8,
+      // First histogram bin holds stages shorter than this (8us), each
+      // following bin doubles the upper bound and the last one is open ended.
+      E_BIN0_SHIFT = 4,
+    };
+
+  private:
+    struct SStageStats
+    {
+      uint16_t min;
+      uint16_t max;
+      uint32_t sum;
+      uint16_t count;
+      uint16_t bins[E_NUM_BINS];
+    };
+    SStageStats m_stats[NumStages];
+    uint16_t m_cycleStart;
+    uint16_t m_last;
+
+    void update(uint8_t stage, uint16_t delta)
+    {
+      SStageStats &s = m_stats[stage];
+      if (s.count == 0xffff) {
+        // Decay rather than wrap so the average and histogram stay meaningful.
+        s.count >>= 1;
+        s.sum >>= 1;
+        for (uint8_t i = 0; i < E_NUM_BINS; i++)
+          s.bins[i] >>= 1;
+      }
+      s.count++;
+      s.sum += delta;
+      if (delta < s.min)
+        s.min = delta;
+      if (delta > s.max)
+        s.max = delta;
+      uint8_t bin = 0;
+      for (uint16_t v = delta >> E_BIN0_SHIFT; v && (bin < (E_NUM_BINS - 1)); v >>= 1)
+        bin++;
+      s.bins[bin]++;
+    }
+
+  public:
+    inline CLoopProfiler(void) { reset(); }
+    inline ~CLoopProfiler(void) { }
+    inline void begin(void)
+    {
+      // Normal mode, no outputs, clock select F_CPU / 8.
+      TCCR4A = 0;
+      TCCR4B = (1 << CS41);
+      m_cycleStart = m_last = TCNT4;
+    }
+    void reset(void)
+    {
+      for (uint8_t i = 0; i < NumStages; i++) {
+        memset(&m_stats[i], 0, sizeof(m_stats[i]));
+        m_stats[i].min = 0xffff;
+      }
+    }
+    // Mark the start of a loop cycle.
+    inline void start(void) { m_cycleStart = m_last = TCNT4; }
+    // Mark the end of a stage (measured from the previous mark).
+    inline void mark(uint8_t stage)
+    {
+      uint16_t now = TCNT4;
+      update(stage, now - m_last);
+      m_last = now;
+    }
+    // Mark the end of the cycle (measured from start).
+    inline void finish(uint8_t stage)
+    {
+      uint16_t now = TCNT4;
+      update(stage, now - m_cycleStart);
+      m_last = now;
+    }
+    inline uint16_t count(uint8_t stage) { return m_stats[stage].count; }
+    inline uint16_t minTicks(uint8_t stage) { return m_stats[stage].count ? m_stats[stage].min : 0; }
+    inline uint16_t maxTicks(uint8_t stage) { return m_stats[stage].max; }
+    inline uint16_t avgTicks(uint8_t stage) { return m_stats[stage].count ? (m_stats[stage].sum / m_stats[stage].count) : 0; }
+    inline uint16_t bin(uint8_t stage, uint8_t index) { return m_stats[stage].bins[index]; }
+};
+
+#endif
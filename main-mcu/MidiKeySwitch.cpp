@@ -10,8 +10,8 @@
 #include "Arduino.h"
 
 #include "MidiKeySwitch.h"
+#include "Trace.h"
 
-extern bool debug_mode;
 void noteOn(uint8_t note, uint8_t velocity, uint8_t channel);
 void noteOff(uint8_t note, uint8_t velocity, uint8_t channel);
 
@@ -149,53 +149,17 @@ void CMidiKeySwitch::noteOn(uint8_t note, unsigned long ttime)
   }
 
   ::noteOn(note, vel, s_midi_ch);
-  if (debug_mode) {
-    char mbuffer[10];
-    strncpy_P(mbuffer, m_noteName, sizeof(mbuffer) - 1);
-    Serial.print(mbuffer);
-    Serial.print(F(" "));
-    Serial.print(ttime);
-    Serial.print(F(" : "));
-    Serial.println(vel);
-  }
+  trace.record(E_TR_NOTE_ON, vel, m_noteName, (ttime < 0xffff) ? ttime : 0xffff);
 }
 
 void CMidiKeySwitch::noteOff(uint8_t note, unsigned long ttime)
 {
   uint8_t vel = 0;
   ::noteOff(note, vel, s_midi_ch);
-  if (debug_mode) {
-    char mbuffer[10];
-    strncpy_P(mbuffer, m_noteName, sizeof(mbuffer) - 1);
-    Serial.print(mbuffer);
-    Serial.print(F(" off: "));
-    Serial.print(ttime);
-    Serial.print(F("[ "));
-    Serial.print(s_glitchCount);
-    Serial.println(F(" ]"));
-  }
+  trace.record(E_TR_NOTE_OFF, vel, m_noteName, (ttime < 0xffff) ? ttime : 0xffff);
 }
 
 void CMidiKeySwitch::stateError(uint8_t note, unsigned long ttime, uint8_t key, bool nc, bool no)
 {
-  if (debug_mode) {
-    char mbuffer[10];
-    Serial.print(F("Note: "));
-    Serial.print(note);
-    Serial.print(F(": "));
-    strncpy_P(mbuffer, m_noteName, sizeof(mbuffer) - 1);
-    Serial.print(mbuffer);
-    Serial.print(F(" error: "));
-    Serial.print(ttime);
-    Serial.print(F("[ "));
-    Serial.print(key);
-    Serial.print(F(", "));
-    Serial.print(nc);
-    Serial.print(F(", "));
-    Serial.print(no);
-    Serial.print(F(", "));
-    Serial.print(s_glitchCount);
-    Serial.println(F(" ]"));
-  }
+  trace.record(E_TR_KEY_ERROR, (key & 0x3f) | (nc ? 0x40 : 0) | (no ? 0x80 : 0), m_noteName, s_glitchCount);
 }
-
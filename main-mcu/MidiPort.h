@@ -21,12 +21,25 @@ class CMidiPort
     bool m_runningStatus;
     void (* m_cbSetLed) (bool);
     void (* m_handleRxMidi) (uint8_t, uint8_t, uint8_t, uint8_t);
+    void (* m_handleRxSysEx) (uint8_t *, uint8_t);
     uint8_t m_rxRunningStatus;
     uint8_t m_txRunningStatus;
     uint8_t m_rxData1;
     uint8_t m_txCable;
     uint8_t m_rxCable;
     bool m_rxEscape;
+    enum properties
+    {
+      E_SYSEX_RX_SIZE = 16,
+      E_SYSEX_RX_OVERFLOW = 0xff,
+      // Credit grants are in units of 4 bytes, 1 to 7 of them per escape.
+      E_CREDIT_UNIT = 4,
+      E_CREDIT_MAX_UNITS = 7,
+      // Credit reset escape (0xfd, 0x80 | cable).
+      E_CREDIT_RESET = 0x80,
+    };
+    uint8_t m_rxSysEx[E_SYSEX_RX_SIZE];
+    uint8_t m_rxSysExLen;
     enum state
     {
       E_MS_
@@ -66,11 +79,27 @@ class CMidiPort
             // Store the received byte.
             m_rxData1 = rxByte;
           }
+        } else if (m_rxRunningStatus == 0xf0) {
+          // Collect the SysEx body (too long for the buffer is flagged and discarded at the end).
+          if (m_rxSysExLen < E_SYSEX_RX_SIZE)
+            m_rxSysEx[m_rxSysExLen++] = rxByte;
+          else
+            m_rxSysExLen = E_SYSEX_RX_OVERFLOW;
         } else {
           // Ignore the data byte.
         }
       } else if (rxByte >= 0xf8) {
         // A real time message - ignore it.
+      } else if (rxByte == 0xf0) {
+        // Start of SysEx (any channel / cable filtering is up to the invoker).
+        m_rxRunningStatus = 0xf0;
+        m_rxSysExLen = 0;
+      } else if ((rxByte == 0xf7) && (m_rxRunningStatus == 0xf0)) {
+        // End of SysEx - invoke the callback with the body (less the 0xf0 / 0xf7 framing).
+        if (m_handleRxSysEx && (m_rxSysExLen != E_SYSEX_RX_OVERFLOW))
+          m_handleRxSysEx(m_rxSysEx, m_rxSysExLen);
+        m_rxRunningStatus = 255;
+        rc = true;
       } else if ((rxStatus == 0xb0) && (rxChannel == channel)) {
         // A CC status byte
         m_rxRunningStatus = 0xb0;
@@ -94,6 +123,8 @@ class CMidiPort
       m_serial(serialPort),
       m_cbSetLed(0),
       m_handleRxMidi(0),
+      m_handleRxSysEx(0),
+      m_rxSysExLen(0),
       m_txRunningStatus(0),
       m_rxRunningStatus(255),
       m_rxData1(255),
@@ -112,6 +143,10 @@ class CMidiPort
       m_cbSetLed = cbSetLed;
       m_handleRxMidi = cbRxMidi;
     }
+    inline void setSysExHandler(void (* cbRxSysEx) (uint8_t *, uint8_t))
+    {
+      m_handleRxSysEx = cbRxSysEx;
+    }
     inline void write(uint8_t data, uint8_t cable = 0)
     {
       if (cable != m_txCable) {
@@ -129,6 +164,35 @@ class CMidiPort
         m_serial.write(buf, len);
       }
     }
+    // Raw binary data on a cable (0xfd is escaped, so any byte value goes through).
+    inline void writeRaw(uint8_t data, uint8_t cable)
+    {
+      write(data, cable);
+      if (data == 0xfd)
+        m_serial.write(data);
+    }
+    inline int availableForWrite(void) { return m_serial.availableForWrite(); }
+    // Grant the USB MCU credit for more bytes on a cable from the host (escape
+    // 0xfd, units << 4 | cable - see usb-mcu midi-mux.c), leaving the cable as
+    // is.  Returns the bytes granted, rounded down to whole units (at most 28).
+    inline uint8_t grantCredit(uint8_t cable, uint8_t bytes)
+    {
+      uint8_t units = bytes / E_CREDIT_UNIT;
+      if (units > E_CREDIT_MAX_UNITS)
+        units = E_CREDIT_MAX_UNITS;
+      if (units) {
+        m_serial.write(0xfd);
+        m_serial.write((units << 4) | (cable & 0x0f));
+      }
+      return units * E_CREDIT_UNIT;
+    }
+    // Drop whatever credit the USB MCU holds for a cable from the host (escape
+    // 0xfd, 0x80 | cable), leaving it flow controlled until the next grant.
+    inline void resetCredit(uint8_t cable)
+    {
+      m_serial.write(0xfd);
+      m_serial.write(E_CREDIT_RESET | (cable & 0x0f));
+    }
     inline bool available(uint16_t cableMask = 0xffff)
     {
       if ((cableMask & (1 << m_rxCable)) == 0)
@@ -203,6 +267,18 @@ class CMidiPort
         write(msgType);
       }
     }
+    inline void sendSysEx(const uint8_t *data, uint8_t len, uint8_t cable = 0)
+    {
+      if (!m_running)
+        return;
+      // SysEx cancels running status.
+      m_txRunningStatus = 0;
+      write(0xf0, cable);
+      while (len--) {
+        write(*(data++) & 0x7f, cable);
+      }
+      write(0xf7, cable);
+    }
     inline void noteOn(uint8_t note, uint8_t velocity, uint8_t channel = 0, uint8_t cable = 0) { send( 0x90, note, velocity, channel, cable ); }
     inline void noteOff(uint8_t note, uint8_t velocity, uint8_t channel = 0, uint8_t cable = 0)
     {
@@ -232,5 +308,94 @@ class CMidiPort
     }
 };
 
+// Credit based flow control of one cable from the USB link, passed through to
+// another serial port.  The USB MCU holds back the cable's data (NAKing the
+// host) until granted credit, which is only given for room in the destination's
+// transmit buffer, so passing it on never blocks and nothing backs up into the
+// receive buffer of the link.  The count is resynchronised by resetting the
+// USB MCU's credit at startup (it may hold credit from before this MCU reset),
+// and again whenever the cable has been quiet for a while (the USB MCU may have
+// reset and lost the credit this side still counts as outstanding).
+template<class SerialPort, class DestPort>
+class CMidiCredit
+{
+  private:
+    enum properties
+    {
+      // Most credit outstanding, so bursts on all the cables fit in the 64 byte
+      // receive buffer of the link (and one grant escape covers it).
+      E_CREDIT_MAX = 24,
+      // Least credit worth a grant (2 bytes on the link).
+      E_CREDIT_MIN = 8,
+      // Quiet time before resynchronising the credit (ms).
+      E_CREDIT_RESYNC_MS = 1000,
+    };
+    CMidiPort<SerialPort>& m_port;
+    DestPort& m_dest;
+    uint8_t m_cable;
+    uint8_t m_outstanding; // Granted, not yet received.
+    uint16_t m_lastMs; // Last data received (or resynchronised).
+
+    inline void resync(void)
+    {
+      m_port.resetCredit(m_cable);
+      m_outstanding = 0;
+      m_lastMs = millis();
+    }
+
+  public:
+    inline CMidiCredit(CMidiPort<SerialPort>& port, DestPort& dest, uint8_t cable) :
+      m_port(port),
+      m_dest(dest),
+      m_cable(cable),
+      m_outstanding(0),
+      m_lastMs(0) { }
+    // Start from no credit, whatever the USB MCU was left with.
+    inline void begin(void)
+    {
+      resync();
+    }
+    // Grant the room that has opened up in the destination.
+    inline void update(void)
+    {
+      if (m_outstanding && ((uint16_t)((uint16_t)millis() - m_lastMs) >= E_CREDIT_RESYNC_MS))
+        resync();
+      int room = m_dest.availableForWrite() - m_outstanding;
+      if (room > (E_CREDIT_MAX - m_outstanding))
+        room = E_CREDIT_MAX - m_outstanding;
+      if (room >= E_CREDIT_MIN)
+        m_outstanding += m_port.grantCredit(m_cable, room);
+    }
+    // Data received on the cable (and passed on).
+    inline void received(size_t len)
+    {
+      m_outstanding = (len < m_outstanding) ? (m_outstanding - len) : 0;
+      m_lastMs = millis();
+    }
+};
+
+// Raw binary stream on one cable of a MIDI port (e.g. trace frames on the USB
+// telemetry cable), for anything that writes to a Print.
+template<class SerialPort>
+class CMidiCableStream : public Print
+{
+  private:
+    CMidiPort<SerialPort>& m_port;
+    uint8_t m_cable;
+
+  public:
+    inline CMidiCableStream(CMidiPort<SerialPort>& port, uint8_t cable) :
+      m_port(port),
+      m_cable(cable) { }
+    virtual size_t write(uint8_t data) { m_port.writeRaw(data, m_cable); return 1; }
+    using Print::write;
+    // Room without blocking, if every byte has to be escaped after a cable change.
+    virtual int availableForWrite(void)
+    {
+      int room = m_port.availableForWrite() - 2;
+      return (room > 0) ? (room / 2) : 0;
+    }
+};
+
 #endif
 
@@ -0,0 +1,119 @@
+/////////////////////////////////////////////////////////////////////
+// Quadrature decoder for a detented rotary encoder (with acceleration).
+//
+// Copyright 2018, Darcy Watkins
+// All Rights Reserved.
+//
+// Available under Mozilla Public License Version 2.0
+// See the LICENSE file for license terms.
+/////////////////////////////////////////////////////////////////////
+#include "Arduino.h"
+
+#include "RotaryEncoder.h"
+
+// Indexed by (previous pins << 2) | pins.  Clockwise is 00 -> 01 -> 11 -> 10.
+// Both pins changing (2) means a state was missed, so assume the spin continues.
+const int8_t CRotaryEncoder::s_transitions[16] PROGMEM =
+{
+   0, +1, -1,  2,
+  -1,  0,  2, +1,
+  +1,  2,  0, -1,
+   2, -1, +1,  0,
+};
+
+// Acceleration - detents closer together than the interval (us) are multiplied.
+static const struct
+{
+  uint32_t interval;
+  int8_t factor;
+} s_accelCurve[] =
+{
+  { 12000, 8 },
+  { 25000, 4 },
+  { 50000, 2 },
+};
+
+CRotaryEncoder::CRotaryEncoder(void) :
+  m_state(0),
+  m_lastDir(0),
+  m_steps(0),
+  m_pending(0),
+  m_detentDir(0),
+  m_detentTime(0),
+  m_head(0),
+  m_tail(0)
+{
+}
+
+CRotaryEncoder::~CRotaryEncoder(void)
+{
+}
+
+void CRotaryEncoder::begin(uint8_t pins)
+{
+  m_state = pins & 0x03;
+}
+
+void CRotaryEncoder::update(uint8_t pins)
+{
+  pins &= 0x03;
+  if (pins == m_state)
+    return;
+
+  int8_t dir = pgm_read_byte(&s_transitions[(m_state << 2) | pins]);
+  m_state = pins;
+  if (dir == 2) {
+    dir = m_lastDir * 2;
+  } else {
+    m_lastDir = dir;
+  }
+  m_steps += dir;
+  if (pins == E_DETENT_PINS) {
+    // Back at rest - resync so a missed or bounced step never carries over
+    // into the next detent.
+    if (m_steps >= (E_STEPS_PER_DETENT / 2)) {
+      detent(1);
+    } else if (m_steps <= -(E_STEPS_PER_DETENT / 2)) {
+      detent(-1);
+    }
+    m_steps = 0;
+  }
+}
+
+void CRotaryEncoder::detent(int8_t dir)
+{
+  uint32_t now = micros();
+  uint32_t interval = now - m_detentTime;
+  m_detentTime = now;
+
+  // Only a continued spin is accelerated, never a change of direction.
+  int8_t delta = dir;
+  for (uint8_t i = 0; (dir == m_detentDir) && (i < (sizeof(s_accelCurve) / sizeof(s_accelCurve[0]))); i++) {
+    if (interval < s_accelCurve[i].interval) {
+      delta *= s_accelCurve[i].factor;
+      break;
+    }
+  }
+  m_detentDir = dir;
+
+  // Anything that did not fit in the queue last time is carried along.
+  delta += m_pending;
+  m_pending = 0;
+  uint8_t next = (m_head + 1) & E_QUEUE_MASK;
+  if (next == m_tail) {
+    m_pending = constrain(delta, -64, 64);
+    return;
+  }
+  m_queue[m_head] = delta;
+  m_head = next;
+}
+
+bool CRotaryEncoder::read(int8_t &delta)
+{
+  uint8_t tail = m_tail;
+  if (tail == m_head)
+    return false;
+  delta = m_queue[tail];
+  m_tail = (tail + 1) & E_QUEUE_MASK;
+  return true;
+}
@@ -0,0 +1,51 @@
+/////////////////////////////////////////////////////////////////////
+// Quadrature decoder for a detented rotary encoder (with acceleration).
+//
+// Copyright 2018, Darcy Watkins
+// All Rights Reserved.
+//
+// Available under Mozilla Public License Version 2.0
+// See the LICENSE file for license terms.
+/////////////////////////////////////////////////////////////////////
+#ifndef __ROTARYENCODER_H
+#define __ROTARYENCODER_H
+
+#include "Arduino.h"
+
+class CRotaryEncoder
+{
+  public:
+    enum properties
+    {
+      E_STEPS_PER_DETENT = 4,
+      E_DETENT_PINS = 0x03, // Both contacts open (pulled up) when resting at a detent.
+      E_QUEUE_SIZE = 8, // Must be a power of 2 (holds E_QUEUE_SIZE - 1 events).
+      E_QUEUE_MASK = E_QUEUE_SIZE - 1,
+    };
+
+  private:
+    static const int8_t s_transitions[16];
+    uint8_t m_state;
+    int8_t m_lastDir;
+    int8_t m_steps;
+    int8_t m_pending;
+    int8_t m_detentDir;
+    uint32_t m_detentTime;
+    // Single producer (update) / single consumer (read) event queue.
+    int8_t m_queue[E_QUEUE_SIZE];
+    volatile uint8_t m_head;
+    volatile uint8_t m_tail;
+    void detent(int8_t dir);
+
+  public:
+    CRotaryEncoder(void);
+    ~CRotaryEncoder(void);
+    // Pin states are passed as (clk << 1) | dt.
+    void begin(uint8_t pins);
+    // Call with interrupts disabled (from the pin change ISR, or polled).
+    void update(uint8_t pins);
+    // Get the next accelerated detent count, safe against update from the ISR.
+    bool read(int8_t &delta);
+};
+
+#endif
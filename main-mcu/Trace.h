@@ -0,0 +1,98 @@
+/////////////////////////////////////////////////////////////////////
+// Compact binary trace ring (replaces blocking debug text output).
+//
+// Copyright 2018, Darcy Watkins
+// All Rights Reserved.
+//
+// Available under Mozilla Public License Version 2.0
+// See the LICENSE file for license terms.
+/////////////////////////////////////////////////////////////////////
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include "Arduino.h"
+
+// Trace event IDs (keep tools/trace-decode in sync).
+enum ETraceEvents
+{
+  E_TR_NONE = 0,
+  E_TR_NOTE_ON = 1,     // name: note, arg: velocity, val: key travel time (us)
+  E_TR_NOTE_OFF = 2,    // name: note, arg: 0, val: key travel time (us)
+  E_TR_KEY_ERROR = 3,   // name: note, arg: key | nc << 6 | no << 7, val: glitch count
+  E_TR_SWITCH = 4,      // name: switch, arg: on (1) / off (0)
+  E_TR_FILTER = 5,      // name: filter, arg: region, val: value
+  E_TR_DRAWBAR = 6,     // name: drawbar, arg: position in quarter steps
+  E_TR_LOST = 7,        // val: records overwritten before they were drained
+  E_TR_ENCODER = 8,     // arg: accelerated detent count (signed), val: value swept
+  E_TR_LOOP = 9,        // arg: average loop() cycle (us, max 255), val: longest cycle (us) - per 100ms
+
+  E_TR_AUX = 0x80,      // Flag - record was forwarded from the Aux MCU.
+};
+
+// One trace record.  The name is the PROGMEM address of the object's name
+// string, resolved back to text by the decoder from the firmware ELF file.
+struct __attribute__ ((packed)) STraceRecord
+{
+  uint32_t time; // micros()
+  uint8_t id;
+  uint8_t arg;
+  uint16_t name;
+  uint16_t val;
+};
+
+class CTrace
+{
+  public:
+    enum properties
+    {
+      E_RING_SIZE = 32, // Must be a power of 2 (holds E_RING_SIZE - 1 records).
+      E_RING_MASK = E_RING_SIZE - 1,
+      // Serial framing: sync, record, checksum (XOR of the record bytes).
+      E_FRAME_SYNC = 0xa5,
+      E_FRAME_SIZE = sizeof(STraceRecord) + 2,
+      // SysEx packing of one record (7 data bits per byte, MSBs first of each group of 7).
+      E_PACKED_SIZE = sizeof(STraceRecord) + ((sizeof(STraceRecord) + 6) / 7),
+    };
+
+  private:
+    STraceRecord m_ring[E_RING_SIZE];
+    uint8_t m_head;
+    uint8_t m_tail;
+    uint16_t m_lost;
+    uint8_t m_rxFrame[E_FRAME_SIZE];
+    uint8_t m_rxIdx;
+    void writeFrame(Print &out, const STraceRecord &rec);
+
+  public:
+    CTrace(void);
+    ~CTrace(void);
+    // Fast path - safe from the main thread only (not from an ISR).
+    inline void record(uint8_t id, uint8_t arg = 0, const char *name = 0, uint16_t val = 0)
+    {
+      STraceRecord &r = m_ring[m_head];
+      r.time = micros();
+      r.id = id;
+      r.arg = arg;
+      r.name = (uint16_t)name;
+      r.val = val;
+      m_head = (m_head + 1) & E_RING_MASK;
+      if (m_head == m_tail) {
+        // Full - overwrite the oldest so the most recent history is kept.
+        m_tail = (m_tail + 1) & E_RING_MASK;
+        m_lost++;
+      }
+    }
+    void record(const STraceRecord &rec);
+    inline bool isEmpty(void) { return m_head == m_tail; }
+    bool pop(STraceRecord &rec);
+    // Write as many framed records as fit without blocking.
+    void drain(Print &out);
+    // Feed bytes from another MCU's trace output, returns true if the byte
+    // was taken as part of a frame (anything else is plain text).
+    bool collect(uint8_t c);
+    static uint8_t pack(uint8_t *buf, const STraceRecord &rec);
+};
+
+extern CTrace trace;
+
+#endif
@@ -23,8 +23,13 @@
 #include "MidiKeySwitch.h"
 #include "LedSwitch.h"
 #include "MidiPort.h"
+#include "LoopProfiler.h"
+#include "Trace.h"
+#include "RotaryEncoder.h"
 
 #define FORCE_DEBUG 0
+// Set to 1 to build in the loop() stage profiler (dumped via SysEx query).
+#define LOOP_PROFILE 0
 
 #define __READ_BIT(p,b) (p & (1 << b))
 #define __WRITE_BIT(p ,b, e) \
@@ -88,6 +93,7 @@ const int modeSwitchPin = 41;
 const int dipSwPin[4] =  {2, 3, 4, 5}; // pin address
 
 // Variables
+CTrace trace;
 bool ledState = LOW; // used to set the LED
 uint32_t ledPreviousMicros = 0; // will store last time LED was updated
 bool debug_mode;
@@ -219,15 +225,39 @@ enum UsbMidiCables {
   E_USBMIDI_INTERNAL = 0,
   E_USBMIDI_JACK1 = 1,
   E_USBMIDI_JACK2 = 2,
+  E_USBMIDI_TELEMETRY = 15, // Not MIDI - raw to the USB MCU's telemetry endpoint.
 };
 CMidiPort<HardwareSerial> midiUSB((HardwareSerial&)Serial);
 
+// SysEx messages on the internal cable use the non-commercial manufacturer ID.
+//   Query:    0xf0, SYSEX_ID, command, 0xf7
+//   Response: 0xf0, SYSEX_ID, command, payload ..., 0xf7
+#define SYSEX_ID 0x7d
+enum ESysExCmds
+{
+  E_SYSX_PROFILE_QUERY = 0x01, // One response per stage (see sendProfileReport).
+  E_SYSX_PROFILE_RESET = 0x02, // No response.
+  E_SYSX_TRACE_DUMP = 0x03,    // One response per trace record (see sendTraceRecords).
+  E_SYSX_I2C_HEALTH = 0x04,    // Unsolicited from the Aux MCU (see aux sendI2cHealth).
+  E_SYSX_I2C_SPEED = 0x05,     // Unsolicited from the Aux MCU (see aux sendI2cSpeed).
+  E_SYSX_TELEMETRY = 0x06,     // Payload: 1 to stream trace frames on the telemetry cable, 0 to stop.
+};
+
+// Trace frames stream to the host (USB MCU telemetry endpoint) while enabled.
+CMidiCableStream<HardwareSerial> usbTelemetry(midiUSB, E_USBMIDI_TELEMETRY);
+bool telemetry = false;
+
 // The main MIDI-Out and MIDI-In jacks on back of the keyboard.
 CMidiPort<HardwareSerial> midiJacks((HardwareSerial&)Serial1);
 
 // The MIDI-Thru/Out2 jack on back of the keyboard and MIDI input B2B from Aux MCU's MIDI output.
 CMidiPort<HardwareSerial> midiB2bThru((HardwareSerial&)Serial2);
 
+// Flow control of the USB-MIDI cables passed through to the jacks, which drain
+// at 31250 baud while the USB link runs at 1Mbps.
+CMidiCredit<HardwareSerial, HardwareSerial> midiJack1Credit(midiUSB, (HardwareSerial&)Serial1, E_USBMIDI_JACK1);
+CMidiCredit<HardwareSerial, HardwareSerial> midiJack2Credit(midiUSB, (HardwareSerial&)Serial2, E_USBMIDI_JACK2);
+
 enum EUseCase
 {
   E_UC_SIMPLE_CC = 0,
@@ -238,6 +268,31 @@ enum EUseCase
   E_UC_NUM_USECASES
 };
 
+// Stages of the loop() timed by the profiler.
+enum EProfileStages
+{
+  E_PS_HOUSEKEEPING = 0,  // Telemetry / rear encoder / LED blink / active sense / debug
+  E_PS_KBD_SCAN = 1,      // Keyboard scan and column select
+  E_PS_SWITCH_LED_SCAN = 2, // LED / switch matrix and misc switches
+  E_PS_USB_RX_SCAN = 3,   // USB-MIDI internal cable receive
+  E_PS_JACK_THRU = 4,     // JACK1 / JACK2 pass through
+  E_PS_B2B_RX_SCAN = 5,   // B2B (or aux debug) receive
+  E_PS_CYCLE = 6,         // Whole loop() cycle
+
+  E_PS_NUM_STAGES
+};
+
+#if LOOP_PROFILE
+CLoopProfiler<E_PS_NUM_STAGES> loopProfiler;
+#define PROFILE_START() loopProfiler.start()
+#define PROFILE_MARK(s) loopProfiler.mark(s)
+#define PROFILE_FINISH(s) loopProfiler.finish(s)
+#else
+#define PROFILE_START()
+#define PROFILE_MARK(s)
+#define PROFILE_FINISH(s)
+#endif
+
 // Regular scanning of input switches.
 void scan_misc_switches( uint32_t timeS )
 {
@@ -544,29 +599,114 @@ void handleB2BMidi(uint8_t status, uint8_t data1, uint8_t data2, uint8_t channel
   }
 }
 
-// TODO - FIXME - Rotary encoder appears to advance 2 counts per click while turning
-//        although it is possible to turn slow enough to observe the count between
-//        adjacent click points.
-int rearEncoderPosDebug = 0;
-volatile int rearEncoderPosCount = 0;
-volatile int rearEncoderClkLast;
-ISR(PCINT2_vect)
+// Aux MCU reports are passed on to the host.
+void handleB2BSysEx(uint8_t *data, uint8_t len)
 {
-  bool pinA_clk = READ_BIT(REAR_ENCODER_CLK);
-  if (pinA_clk != rearEncoderClkLast) {
-    // Pin change has occured.
-    bool pinB_dt = READ_BIT(REAR_ENCODER_DT);
-    if (pinA_clk == pinB_dt) {
-      // PinA/Clk changed first - clockwise
-      rearEncoderPosCount++;
-    } else {
-      // PinB/DT changed first - clockwise
-      rearEncoderPosCount--;
-    }
-    rearEncoderClkLast = pinA_clk;
+  if ((len > 0) && (data[0] == SYSEX_ID) && !debug_mode) {
+    midiUSB.sendSysEx(data, len, E_USBMIDI_INTERNAL);
+  }
+}
+
+// Pack a 16 bit value into three SysEx data bytes (MS first).
+static uint8_t *sysExPut16(uint8_t *buf, uint16_t val)
+{
+  *(buf++) = (val >> 14) & 0x03;
+  *(buf++) = (val >> 7) & 0x7f;
+  *(buf++) = val & 0x7f;
+  return buf;
+}
+
+#if LOOP_PROFILE
+// Profile report for one stage (times in profiler ticks):
+//   stage, count, min, avg, max, bins[0..7] - all but stage packed as sysExPut16.
+void sendProfileReport(uint8_t stage)
+{
+  uint8_t msg[3 + ((4 + CLoopProfiler<E_PS_NUM_STAGES>::E_NUM_BINS) * 3)];
+  uint8_t *p = msg;
+  *(p++) = SYSEX_ID;
+  *(p++) = E_SYSX_PROFILE_QUERY;
+  *(p++) = stage;
+  p = sysExPut16(p, loopProfiler.count(stage));
+  p = sysExPut16(p, loopProfiler.minTicks(stage));
+  p = sysExPut16(p, loopProfiler.avgTicks(stage));
+  p = sysExPut16(p, loopProfiler.maxTicks(stage));
+  for (uint8_t i = 0; i < CLoopProfiler<E_PS_NUM_STAGES>::E_NUM_BINS; i++)
+    p = sysExPut16(p, loopProfiler.bin(stage, i));
+  midiUSB.sendSysEx(msg, p - msg, E_USBMIDI_INTERNAL);
+}
+#endif
+
+// Drain the trace ring, one record per message (packed by CTrace::pack).
+void sendTraceRecords(void)
+{
+  uint8_t msg[2 + CTrace::E_PACKED_SIZE];
+  STraceRecord rec;
+  msg[0] = SYSEX_ID;
+  msg[1] = E_SYSX_TRACE_DUMP;
+  while (trace.pop(rec)) {
+    midiUSB.sendSysEx(msg, 2 + CTrace::pack(&msg[2], rec), E_USBMIDI_INTERNAL);
   }
 }
 
+// Loop timing for the telemetry stream, one record per 100ms.
+void loopTelemetry(unsigned long cycle, unsigned long now)
+{
+  static unsigned long periodStart = 0;
+  static uint16_t cycles = 0;
+  static uint16_t longest = 0;
+  if (cycle > longest)
+    longest = min(cycle, 0xffffUL);
+  if (cycles < 0xffff)
+    cycles++;
+  if ((now - periodStart) >= 100000) {
+    trace.record(E_TR_LOOP, min((now - periodStart) / cycles, 255UL), 0, longest);
+    periodStart = now;
+    cycles = 0;
+    longest = 0;
+  }
+}
+
+void handleSysEx(uint8_t *data, uint8_t len)
+{
+  if ((len < 2) || (data[0] != SYSEX_ID))
+    return;
+  switch (data[1])
+  {
+#if LOOP_PROFILE
+    case E_SYSX_PROFILE_QUERY:
+      for (uint8_t i = 0; i < E_PS_NUM_STAGES; i++)
+        sendProfileReport(i);
+      break;
+    case E_SYSX_PROFILE_RESET:
+      loopProfiler.reset();
+      break;
+#endif
+    case E_SYSX_TRACE_DUMP:
+      sendTraceRecords();
+      break;
+    case E_SYSX_TELEMETRY:
+      telemetry = (len > 2) && data[2];
+      break;
+    default:
+      break;
+  }
+}
+
+// Rear rotary encoder.  Only Clk (PK7) has a pin change interrupt, so Dt (PD7)
+// edges are picked up by also polling the decoder from loop().
+CRotaryEncoder rearEncoder;
+uint8_t rearEncoderValue = 0; // Parameter swept by the encoder (0 - 127).
+
+inline uint8_t rearEncoderPins(void)
+{
+  return (READ_BIT(REAR_ENCODER_CLK) ? 0x02 : 0) | (READ_BIT(REAR_ENCODER_DT) ? 0x01 : 0);
+}
+
+ISR(PCINT2_vect)
+{
+  rearEncoder.update(rearEncoderPins());
+}
+
 // The setup() function runs once at startup.
 void setup()
 {
@@ -657,8 +797,8 @@ void setup()
   PCMSK2 = 0x80;
   // Enable PCINT2 ISR.
   PCICR |= 0x04;
-  // Get initial state of encoder clk (pin A).
-  rearEncoderClkLast = READ_BIT(REAR_ENCODER_CLK);
+  // Get initial state of the encoder pins.
+  rearEncoder.begin(rearEncoderPins());
 
 #if FORCE_DEBUG
   Serial.begin(230400);
@@ -681,6 +821,10 @@ void setup()
   if (!debug_mode) {
     // Use USB serial for MIDI (and at 1Mb/s)
     midiUSB.begin(&setLed, &handleRxMidi, 1000000);
+    midiUSB.setSysExHandler(&handleSysEx);
+    // Drop any credit the USB MCU holds from before this reset.
+    midiJack1Credit.begin();
+    midiJack2Credit.begin();
   } else {
     // Initialize serial UART for debug output.
 #if ! FORCE_DEBUG
@@ -728,8 +872,13 @@ void setup()
   } else {
     // Start the MIDI port.
     midiB2bThru.begin(&setLed, &handleB2BMidi);
+    midiB2bThru.setSysExHandler(&handleB2BSysEx);
   }
   // Serial3 - spare / unused.
+
+#if LOOP_PROFILE
+  loopProfiler.begin();
+#endif
 }
 
 // The loop() function is invoked over and over again.
@@ -737,7 +886,22 @@ static uint8_t midiBuffer[64];
 void loop()
 {
   size_t len;
+  PROFILE_START();
   unsigned long currentMicros = micros();
+  static unsigned long lastLoopMicros = 0;
+  if (telemetry)
+    loopTelemetry(currentMicros - lastLoopMicros, currentMicros);
+  lastLoopMicros = currentMicros;
+
+  // Catch the rear encoder Dt edges (no pin change interrupt on that pin).
+  noInterrupts();
+  rearEncoder.update(rearEncoderPins());
+  interrupts();
+  int8_t encDelta;
+  while (rearEncoder.read(encDelta)) {
+    rearEncoderValue = constrain((int)rearEncoderValue + encDelta, 0, 127);
+    trace.record(E_TR_ENCODER, encDelta, 0, rearEncoderValue);
+  }
 
   static unsigned long lastLEDSwitchScanMicros = 0;
   static unsigned led = 0;
@@ -770,17 +934,9 @@ void loop()
       }
       led++;
       led %= 12;
-
-      noInterrupts();
-      int pos = rearEncoderPosCount;
-      interrupts();
-      if (pos != rearEncoderPosDebug) {
-        Serial.print(F("Rear Encoder: "));
-        Serial.println(pos);
-        rearEncoderPosDebug = pos;
-      }
     }
   }
+  PROFILE_MARK(E_PS_HOUSEKEEPING);
 
   // Scan the keyboard rows.
   kbd_scan_keys_selected_column();
@@ -788,6 +944,7 @@ void loop()
   // Advance and select next column.
   kbd_scan_column_index = (kbd_scan_column_index + 1) % 8;
   kbd_select_next_column();
+  PROFILE_MARK(E_PS_KBD_SCAN);
 
   if ((currentMicros - lastLEDSwitchScanMicros) >= 1000) {
     // 1. Read the switch input values for this column.
@@ -800,36 +957,50 @@ void loop()
     // Syncup for next time.
     lastLEDSwitchScanMicros = currentMicros;
   }
+  PROFILE_MARK(E_PS_SWITCH_LED_SCAN);
 
   // Check for and handle receive MIDI messages from USB.
   // USB-MIDI cable 1 - parse to internal
   midiUSB.receiveScan(10, CMidiKeySwitch::getMidiCh(), 1 << E_USBMIDI_INTERNAL);
+  PROFILE_MARK(E_PS_USB_RX_SCAN);
   // USB-MIDI cable 2 - pass through to MIDI-Out Jack
   if ((len = midiUSB.read(midiBuffer, sizeof(midiBuffer), 1 << E_USBMIDI_JACK1)) > 0) {
+    midiJack1Credit.received(len);
     midiJacks.write(midiBuffer, len);
   }
   // USB-MIDI cable 3 - pass through to MIDI-Thru/Out2 Jack
   if ((len = midiUSB.read(midiBuffer, sizeof(midiBuffer), 1 << E_USBMIDI_JACK2)) > 0) {
+    midiJack2Credit.received(len);
     if (!debug_mode_aux) {
       midiB2bThru.write(midiBuffer, len);
     }
   }
   // USB-MIDI anything spurious aimed at other cables
   midiUSB.receiveFlush(0xfff8);
+  if (!debug_mode) {
+    // Credit for the room made in the jacks' transmit buffers.
+    midiJack1Credit.update();
+    midiJack2Credit.update();
+  }
 
   // Check for and handle receive MIDI messages from MIDI-In connector.
   // Pass through to USB MIDI cable 2.
   if ((len = midiJacks.read(midiBuffer, sizeof(midiBuffer))) > 0) {
     midiUSB.write(midiBuffer, len, E_USBMIDI_JACK1);
   }
+  PROFILE_MARK(E_PS_JACK_THRU);
 
   // Check for and handle receive MIDI messages.
   if (debug_mode_aux) {
-    // Aux MCU is in debug mode so receive / repeat any debug output.
+    // Aux MCU is in debug mode so receive its trace records and repeat any text.
     // Note: Max of 100 char, or when newline, or no Rx data available.
     unsigned int polls = 100;
     while ((Serial2.available() > 0) && --polls) {
       uint8_t c = Serial2.read();
+      if (trace.collect(c)) {
+        // Part of a binary trace frame (merged into our own trace).
+        continue;
+      }
       if (debug_mode) {
         Serial.write(c);
       }
@@ -839,5 +1010,15 @@ void loop()
   } else {
     midiB2bThru.receiveScan();
   }
+
+  if (debug_mode) {
+    // Opportunistically send out trace records (never blocks).
+    trace.drain(Serial);
+  } else if (telemetry) {
+    // Likewise, multiplexed with the USB-MIDI.
+    trace.drain(usbTelemetry);
+  }
+  PROFILE_MARK(E_PS_B2B_RX_SCAN);
+  PROFILE_FINISH(E_PS_CYCLE);
 }
 
@@ -0,0 +1,293 @@
+/////////////////////////////////////////////////////////////////////
+// Decode CHI binary trace records (see main-mcu/Trace.h) into text.
+//
+// Copyright 2018, Darcy Watkins
+// All Rights Reserved.
+//
+// Available under Mozilla Public License Version 2.0
+// See the LICENSE file for license terms.
+/////////////////////////////////////////////////////////////////////
+//
+// Build (Linux):
+//   g++ -O2 -o trace-decode trace-decode.cpp
+//
+// Usage:
+//   trace-decode [--main main-mcu.elf] [--aux aux-mcu.elf] [-m] [file]
+//
+// Reads from file (or stdin).  By default the input is the debug mode serial
+// stream of the Main MCU (framed records mixed with plain text, which is
+// passed through).  With -m the input is raw MIDI (e.g. from amidi -d) and the
+// records are taken from the trace dump SysEx responses (F0 7D 03 ... F7).
+// The telemetry endpoint of the USB MCU carries plain frames, so a capture of
+// it decodes as the debug serial stream does (see usb-mcu/README.md).
+//
+// Record names are PROGMEM addresses, looked up in the matching firmware ELF
+// files (the .elf from the Arduino build directory).  Without an ELF file the
+// address is printed instead.
+/////////////////////////////////////////////////////////////////////
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Keep in sync with main-mcu/Trace.h
+enum ETraceEvents
+{
+  E_TR_NONE = 0,
+  E_TR_NOTE_ON = 1,
+  E_TR_NOTE_OFF = 2,
+  E_TR_KEY_ERROR = 3,
+  E_TR_SWITCH = 4,
+  E_TR_FILTER = 5,
+  E_TR_DRAWBAR = 6,
+  E_TR_LOST = 7,
+  E_TR_ENCODER = 8,
+  E_TR_LOOP = 9,
+
+  E_TR_AUX = 0x80,
+};
+
+enum properties
+{
+  E_RECORD_SIZE = 10,
+  E_FRAME_SYNC = 0xa5,
+  E_FRAME_SIZE = E_RECORD_SIZE + 2,
+  E_SYSEX_ID = 0x7d,
+  E_SYSX_TRACE_DUMP = 0x03,
+};
+
+struct STraceRecord
+{
+  uint32_t time;
+  uint8_t id;
+  uint8_t arg;
+  uint16_t name;
+  uint16_t val;
+};
+
+// Flash image of one firmware (the .text section holds the PROGMEM data).
+struct SImage
+{
+  std::vector<uint8_t> text;
+  uint32_t addr;
+};
+
+static SImage images[2]; // Main, Aux
+
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p + 2) << 16); }
+
+static bool loadElf(const char *path, SImage &img)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  std::vector<uint8_t> elf;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    elf.insert(elf.end(), buf, buf + n);
+  fclose(f);
+
+  // AVR images are ELF32 little endian.
+  if ((elf.size() < 52) || memcmp(&elf[0], "\x7f" "ELF\x01\x01", 6)) {
+    fprintf(stderr, "%s: not an ELF32 LE file\n", path);
+    return false;
+  }
+  uint32_t shoff = get32(&elf[32]);
+  uint16_t shentsize = get16(&elf[46]);
+  uint16_t shnum = get16(&elf[48]);
+  uint16_t shstrndx = get16(&elf[50]);
+  if ((shoff + (uint32_t)shnum * shentsize > elf.size()) || (shstrndx >= shnum)) {
+    fprintf(stderr, "%s: bad section table\n", path);
+    return false;
+  }
+  const uint8_t *strsh = &elf[shoff + shstrndx * shentsize];
+  uint32_t stroff = get32(strsh + 16);
+  for (uint16_t i = 0; i < shnum; i++) {
+    const uint8_t *sh = &elf[shoff + i * shentsize];
+    const char *name = (const char *)&elf[stroff + get32(sh)];
+    if (strcmp(name, ".text") == 0) {
+      uint32_t off = get32(sh + 16);
+      uint32_t size = get32(sh + 20);
+      if (off + size > elf.size())
+        break;
+      img.addr = get32(sh + 12);
+      img.text.assign(elf.begin() + off, elf.begin() + off + size);
+      return true;
+    }
+  }
+  fprintf(stderr, "%s: no .text section\n", path);
+  return false;
+}
+
+static std::string lookupName(bool aux, uint16_t addr)
+{
+  const SImage &img = images[aux ? 1 : 0];
+  if (addr && (addr >= img.addr) && (addr < img.addr + img.text.size())) {
+    std::string s;
+    for (uint32_t i = addr - img.addr; (i < img.text.size()) && img.text[i] && (s.size() < 32); i++)
+      s += (char)img.text[i];
+    return s;
+  }
+  char buf[16];
+  snprintf(buf, sizeof(buf), "@%04x", addr);
+  return buf;
+}
+
+static void printRecord(const STraceRecord &r)
+{
+  static const char *regions[] = { "origin", "min", "lower", "max", "upper" };
+  static const char *quarters[] = { "0", "25", "5", "75" };
+  bool aux = r.id & E_TR_AUX;
+  std::string name = lookupName(aux, r.name);
+
+  printf("%10u.%03u %s ", r.time / 1000, r.time % 1000, aux ? "aux " : "main");
+  switch (r.id & ~E_TR_AUX)
+  {
+    case E_TR_NOTE_ON:
+      printf("%s on: %u : %u\n", name.c_str(), r.val, r.arg);
+      break;
+    case E_TR_NOTE_OFF:
+      printf("%s off: %u\n", name.c_str(), r.val);
+      break;
+    case E_TR_KEY_ERROR:
+      printf("%s error: [ %u, %u, %u, %u ]\n", name.c_str(), r.arg & 0x3f,
+             (r.arg >> 6) & 1, (r.arg >> 7) & 1, r.val);
+      break;
+    case E_TR_SWITCH:
+      printf("Switch: %s %s\n", name.c_str(), r.arg ? "on" : "off");
+      break;
+    case E_TR_FILTER:
+      if (r.arg < 5)
+        printf("Filter: %s %s: %u\n", name.c_str(), regions[r.arg], r.val);
+      else
+        printf("Filter: %s region %u: %u\n", name.c_str(), r.arg, r.val);
+      break;
+    case E_TR_DRAWBAR:
+      printf("Drawbar: %s [ %u.%s ]\n", name.c_str(), r.arg / 4, quarters[r.arg % 4]);
+      break;
+    case E_TR_ENCODER:
+      printf("Rear Encoder: %+d [ %u ]\n", (int8_t)r.arg, r.val);
+      break;
+    case E_TR_LOOP:
+      printf("Loop: average %u%s us, longest %u us\n", r.arg, (r.arg == 255) ? "+" : "", r.val);
+      break;
+    case E_TR_LOST:
+      printf("*** %u records lost ***\n", r.val);
+      break;
+    default:
+      printf("unknown id 0x%02x arg %u name %s val %u\n", r.id, r.arg, name.c_str(), r.val);
+      break;
+  }
+}
+
+static void decodeRecord(const uint8_t *p)
+{
+  STraceRecord r;
+  r.time = get32(p);
+  r.id = p[4];
+  r.arg = p[5];
+  r.name = get16(p + 6);
+  r.val = get16(p + 8);
+  printRecord(r);
+}
+
+// Debug serial stream - frames mixed with plain text.
+static void decodeSerial(FILE *in)
+{
+  uint8_t frame[E_FRAME_SIZE];
+  unsigned idx = 0;
+  int c;
+  while ((c = fgetc(in)) != EOF) {
+    if (idx == 0) {
+      if (c != E_FRAME_SYNC) {
+        putchar(c);
+        continue;
+      }
+    }
+    frame[idx++] = c;
+    if (idx < E_FRAME_SIZE)
+      continue;
+    idx = 0;
+    uint8_t chk = 0;
+    for (unsigned i = 1; i <= E_RECORD_SIZE; i++)
+      chk ^= frame[i];
+    if (chk == frame[E_FRAME_SIZE - 1])
+      decodeRecord(&frame[1]);
+    else
+      fprintf(stderr, "bad frame checksum\n");
+    fflush(stdout);
+  }
+}
+
+// Raw MIDI - trace dump SysEx responses (7 bit packed records).
+static void decodeMidi(FILE *in)
+{
+  std::vector<uint8_t> msg;
+  bool inSysEx = false;
+  int c;
+  while ((c = fgetc(in)) != EOF) {
+    if (c == 0xf0) {
+      msg.clear();
+      inSysEx = true;
+    } else if (c == 0xf7) {
+      if (inSysEx && (msg.size() > 2) && (msg[0] == E_SYSEX_ID) && (msg[1] == E_SYSX_TRACE_DUMP)) {
+        uint8_t rec[E_RECORD_SIZE];
+        unsigned len = 0;
+        for (size_t i = 2; (i < msg.size()) && (len < E_RECORD_SIZE); i += 8) {
+          uint8_t msbs = msg[i];
+          for (unsigned j = 0; (j < 7) && (i + 1 + j < msg.size()) && (len < E_RECORD_SIZE); j++)
+            rec[len++] = msg[i + 1 + j] | (((msbs >> j) & 1) << 7);
+        }
+        if (len == E_RECORD_SIZE)
+          decodeRecord(rec);
+        fflush(stdout);
+      }
+      inSysEx = false;
+    } else if (c >= 0xf8) {
+      // Real time may be interleaved anywhere.
+    } else if (c & 0x80) {
+      inSysEx = false;
+    } else if (inSysEx) {
+      msg.push_back(c);
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  bool midi = false;
+  const char *path = 0;
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "--main") == 0) && (i + 1 < argc)) {
+      if (!loadElf(argv[++i], images[0]))
+        return 1;
+    } else if ((strcmp(argv[i], "--aux") == 0) && (i + 1 < argc)) {
+      if (!loadElf(argv[++i], images[1]))
+        return 1;
+    } else if (strcmp(argv[i], "-m") == 0) {
+      midi = true;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "usage: %s [--main main.elf] [--aux aux.elf] [-m] [file]\n", argv[0]);
+      return 1;
+    } else {
+      path = argv[i];
+    }
+  }
+
+  FILE *in = stdin;
+  if (path && !(in = fopen(path, "rb"))) {
+    perror(path);
+    return 1;
+  }
+  if (midi)
+    decodeMidi(in);
+  else
+    decodeSerial(in);
+  return 0;
+}
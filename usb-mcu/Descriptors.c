@@ -246,6 +246,56 @@ const USB_Descriptor_ConfigurationCDC_t PROGMEM ConfigurationDescriptorSerial =
 };
 
 /* for MIDI */
+#if (MIDI_OUT_CABLES < 1) || (MIDI_OUT_CABLES > 16) || (MIDI_IN_CABLES < 1) || (MIDI_IN_CABLES > MIDI_TELEMETRY_CABLE)
+	#error MIDI_OUT_CABLES must be 1 to 16, and MIDI_IN_CABLES 1 to 15 (the last cable of the link is telemetry).
+#endif
+
+/* Jack strings of each cable - the first cables are the Chi's own ports, any others are unnamed. */
+#define MIDI_OUT_CABLE_STR(Cable)  (((Cable) == 0) ? 0x07 : ((Cable) == 1) ? 0x04 : ((Cable) == 2) ? 0x05 : NO_DESCRIPTOR)
+#define MIDI_IN_CABLE_STR(Cable)   (((Cable) == 0) ? 0x06 : ((Cable) == 1) ? 0x03 : NO_DESCRIPTOR)
+
+/* Host to device cable - embedded IN jack, wired to an external OUT jack. */
+#define MIDI_IN_JACK_EMB(Cable)                                                                     \
+	{                                                                                           \
+		.Header                   = {.Size = sizeof(USB_MIDI_In_Jack_t), .Type = DTYPE_AudioInterface}, \
+		.Subtype                  = DSUBTYPE_InputJack,                                     \
+		.JackType                 = MIDI_JACKTYPE_EMBEDDED,                                 \
+		.JackID                   = MIDI_JACK_ID_EMB_IN(Cable),                             \
+		.JackStrIndex             = MIDI_OUT_CABLE_STR(Cable)                               \
+	}
+#define MIDI_OUT_JACK_EXT(Cable)                                                                    \
+	{                                                                                           \
+		.Header                   = {.Size = sizeof(USB_MIDI_Out_Jack_t), .Type = DTYPE_AudioInterface}, \
+		.Subtype                  = DSUBTYPE_OutputJack,                                    \
+		.JackType                 = MIDI_JACKTYPE_EXTERNAL,                                 \
+		.JackID                   = MIDI_JACK_ID_EXT_OUT(Cable),                            \
+		.NumberOfPins             = 1,                                                      \
+		.SourceJackID             = {MIDI_JACK_ID_EMB_IN(Cable)},                           \
+		.SourcePinID              = {0x01},                                                 \
+		.JackStrIndex             = MIDI_OUT_CABLE_STR(Cable)                               \
+	}
+
+/* Device to host cable - external IN jack, wired to an embedded OUT jack. */
+#define MIDI_IN_JACK_EXT(Cable)                                                                     \
+	{                                                                                           \
+		.Header                   = {.Size = sizeof(USB_MIDI_In_Jack_t), .Type = DTYPE_AudioInterface}, \
+		.Subtype                  = DSUBTYPE_InputJack,                                     \
+		.JackType                 = MIDI_JACKTYPE_EXTERNAL,                                 \
+		.JackID                   = MIDI_JACK_ID_EXT_IN(Cable),                             \
+		.JackStrIndex             = MIDI_IN_CABLE_STR(Cable)                                \
+	}
+#define MIDI_OUT_JACK_EMB(Cable)                                                                    \
+	{                                                                                           \
+		.Header                   = {.Size = sizeof(USB_MIDI_Out_Jack_t), .Type = DTYPE_AudioInterface}, \
+		.Subtype                  = DSUBTYPE_OutputJack,                                    \
+		.JackType                 = MIDI_JACKTYPE_EMBEDDED,                                 \
+		.JackID                   = MIDI_JACK_ID_EMB_OUT(Cable),                            \
+		.NumberOfPins             = 1,                                                      \
+		.SourceJackID             = {MIDI_JACK_ID_EXT_IN(Cable)},                           \
+		.SourcePinID              = {0x01},                                                 \
+		.JackStrIndex             = MIDI_IN_CABLE_STR(Cable)                                \
+	}
+
 const USB_Descriptor_ConfigurationMIDI_t PROGMEM ConfigurationDescriptorMIDI =
 {
 	.Config =
@@ -253,7 +303,7 @@ const USB_Descriptor_ConfigurationMIDI_t PROGMEM ConfigurationDescriptorMIDI =
 			.Header                   = {.Size = sizeof(USB_Descriptor_Configuration_Header_t), .Type = DTYPE_Configuration},
 
 			.TotalConfigurationSize   = sizeof(USB_Descriptor_ConfigurationMIDI_t),
-			.TotalInterfaces          = 2,
+			.TotalInterfaces          = 3,
 
 			.ConfigurationNumber      = 1,
 			.ConfigurationStrIndex    = NO_DESCRIPTOR,
@@ -314,139 +364,15 @@ const USB_Descriptor_ConfigurationMIDI_t PROGMEM ConfigurationDescriptorMIDI =
 
 			.AudioSpecification       = VERSION_BCD(01.00),
 
-			.TotalLength              = (sizeof(USB_Descriptor_ConfigurationMIDI_t) -
+			/* Jacks and endpoints of this interface, up to the telemetry interface */
+			.TotalLength              = (offsetof(USB_Descriptor_ConfigurationMIDI_t, Telemetry_Interface) -
 			                             offsetof(USB_Descriptor_ConfigurationMIDI_t, Audio_StreamInterface_SPC))
 		},
 
-	.MIDI_In_Jack_Emb_to_MIDI_Out =
-		{
-			.Header                   = {.Size = sizeof(USB_MIDI_In_Jack_t), .Type = DTYPE_AudioInterface},
-			.Subtype                  = DSUBTYPE_InputJack,
-
-			.JackType                 = MIDI_JACKTYPE_EMBEDDED,
-			.JackID                   = 0x02,
-
-			.JackStrIndex             = 0x04
-		},
-
-	.MIDI_In_Jack_Emb_to_MIDI_Thru =
-		{
-			.Header                   = {.Size = sizeof(USB_MIDI_In_Jack_t), .Type = DTYPE_AudioInterface},
-			.Subtype                  = DSUBTYPE_InputJack,
-
-			.JackType                 = MIDI_JACKTYPE_EMBEDDED,
-			.JackID                   = 0x03,
-
-			.JackStrIndex             = 0x05
-		},
-
-	.MIDI_In_Jack_Emb_to_Internal =
-		{
-			.Header                   = {.Size = sizeof(USB_MIDI_In_Jack_t), .Type = DTYPE_AudioInterface},
-			.Subtype                  = DSUBTYPE_InputJack,
-
-			.JackType                 = MIDI_JACKTYPE_EMBEDDED,
-			.JackID                   = 0x01,
-
-			.JackStrIndex             = 0x07
-		},
-
-	.MIDI_In_Jack_Ext_src_MIDI_In =
-		{
-			.Header                   = {.Size = sizeof(USB_MIDI_In_Jack_t), .Type = DTYPE_AudioInterface},
-			.Subtype                  = DSUBTYPE_InputJack,
-
-			.JackType                 = MIDI_JACKTYPE_EXTERNAL,
-			.JackID                   = 0x04,
-
-			.JackStrIndex             = 0x03
-		},
-
-	.MIDI_In_Jack_Ext_src_Internal =
-		{
-			.Header                   = {.Size = sizeof(USB_MIDI_In_Jack_t), .Type = DTYPE_AudioInterface},
-			.Subtype                  = DSUBTYPE_InputJack,
-
-			.JackType                 = MIDI_JACKTYPE_EXTERNAL,
-			.JackID                   = 0x05,
-
-			.JackStrIndex             = 0x06
-		},
-
-	.MIDI_Out_Jack_Ext_dst_MIDI_Out =
-		{
-			.Header                   = {.Size = sizeof(USB_MIDI_Out_Jack_t), .Type = DTYPE_AudioInterface},
-			.Subtype                  = DSUBTYPE_OutputJack,
-
-			.JackType                 = MIDI_JACKTYPE_EXTERNAL,
-			.JackID                   = 0x06,
-
-			.NumberOfPins             = 1,
-			.SourceJackID             = {0x02},
-			.SourcePinID              = {0x01},
-
-			.JackStrIndex             = 0x04
-		},
-
-	.MIDI_Out_Jack_Ext_dst_MIDI_Thru =
-		{
-			.Header                   = {.Size = sizeof(USB_MIDI_Out_Jack_t), .Type = DTYPE_AudioInterface},
-			.Subtype                  = DSUBTYPE_OutputJack,
-
-			.JackType                 = MIDI_JACKTYPE_EXTERNAL,
-			.JackID                   = 0x07,
-
-			.NumberOfPins             = 1,
-			.SourceJackID             = {0x03},
-			.SourcePinID              = {0x01},
-
-			.JackStrIndex             = 0x05
-		},
-
-	.MIDI_Out_Jack_Ext_dst_Internal =
-		{
-			.Header                   = {.Size = sizeof(USB_MIDI_Out_Jack_t), .Type = DTYPE_AudioInterface},
-			.Subtype                  = DSUBTYPE_OutputJack,
-
-			.JackType                 = MIDI_JACKTYPE_EXTERNAL,
-			.JackID                   = 0x08,
-
-			.NumberOfPins             = 1,
-			.SourceJackID             = {0x01},
-			.SourcePinID              = {0x01},
-
-			.JackStrIndex             = 0x07
-		},
-
-	.MIDI_Out_Jack_Emb_from_MIDI_In =
-		{
-			.Header                   = {.Size = sizeof(USB_MIDI_Out_Jack_t), .Type = DTYPE_AudioInterface},
-			.Subtype                  = DSUBTYPE_OutputJack,
-
-			.JackType                 = MIDI_JACKTYPE_EMBEDDED,
-			.JackID                   = 0x09,
-
-			.NumberOfPins             = 1,
-			.SourceJackID             = {0x04},
-			.SourcePinID              = {0x01},
-
-			.JackStrIndex             = 0x03
-		},
-
-	.MIDI_Out_Jack_Emb_from_Internal =
-		{
-			.Header                   = {.Size = sizeof(USB_MIDI_Out_Jack_t), .Type = DTYPE_AudioInterface},
-			.Subtype                  = DSUBTYPE_OutputJack,
-
-			.JackType                 = MIDI_JACKTYPE_EMBEDDED,
-			.JackID                   = 0x0a,
-
-			.NumberOfPins             = 1,
-			.SourceJackID             = {0x05},
-			.SourcePinID              = {0x01},
-
-			.JackStrIndex             = 0x06
-		},
+	.MIDI_In_Jack_Emb         = {MIDI_REPEAT(MIDI_OUT_CABLES, MIDI_IN_JACK_EMB)},
+	.MIDI_Out_Jack_Ext        = {MIDI_REPEAT(MIDI_OUT_CABLES, MIDI_OUT_JACK_EXT)},
+	.MIDI_In_Jack_Ext         = {MIDI_REPEAT(MIDI_IN_CABLES, MIDI_IN_JACK_EXT)},
+	.MIDI_Out_Jack_Emb        = {MIDI_REPEAT(MIDI_IN_CABLES, MIDI_OUT_JACK_EMB)},
 
 	.MIDI_In_Jack_Endpoint =
 		{
@@ -456,7 +382,7 @@ const USB_Descriptor_ConfigurationMIDI_t PROGMEM ConfigurationDescriptorMIDI =
 
 					.EndpointAddress     = (ENDPOINT_DESCRIPTOR_DIR_OUT | MIDI_STREAM_OUT_EPNUM),
 					.Attributes          = (EP_TYPE_BULK | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
-					.EndpointSize        = MIDI_STREAM_EPSIZE,
+					.EndpointSize        = MIDI_STREAM_OUT_EPSIZE,
 					.PollingIntervalMS   = 0x00
 				},
 
@@ -466,11 +392,11 @@ const USB_Descriptor_ConfigurationMIDI_t PROGMEM ConfigurationDescriptorMIDI =
 
 	.MIDI_In_Jack_Endpoint_SPC =
 		{
-			.Header                   = {.Size = sizeof(USB_MIDI_Jack_Endpoint_t), .Type = DTYPE_AudioEndpoint},
+			.Header                   = {.Size = sizeof(MIDI_JACK_ENDPOINT_DESCRIPTOR(MIDI_OUT_CABLES)), .Type = DTYPE_AudioEndpoint},
 			.Subtype                  = DSUBTYPE_General,
 
-			.TotalEmbeddedJacks       = 0x03,
-			.AssociatedJackID         = {0x01, 0x02, 0x03}
+			.TotalEmbeddedJacks       = MIDI_OUT_CABLES,
+			.AssociatedJackID         = {MIDI_REPEAT(MIDI_OUT_CABLES, MIDI_JACK_ID_EMB_IN)}
 		},
 
 	.MIDI_Out_Jack_Endpoint =
@@ -481,7 +407,7 @@ const USB_Descriptor_ConfigurationMIDI_t PROGMEM ConfigurationDescriptorMIDI =
 
 					.EndpointAddress     = (ENDPOINT_DESCRIPTOR_DIR_IN | MIDI_STREAM_IN_EPNUM),
 					.Attributes          = (EP_TYPE_BULK | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
-					.EndpointSize        = MIDI_STREAM_EPSIZE,
+					.EndpointSize        = MIDI_STREAM_IN_EPSIZE,
 					.PollingIntervalMS   = 0x00
 				},
 
@@ -491,11 +417,37 @@ const USB_Descriptor_ConfigurationMIDI_t PROGMEM ConfigurationDescriptorMIDI =
 
 	.MIDI_Out_Jack_Endpoint_SPC =
 		{
-			.Header                   = {.Size = sizeof(USB_MIDI_Jack_Endpoint_t), .Type = DTYPE_AudioEndpoint},
+			.Header                   = {.Size = sizeof(MIDI_JACK_ENDPOINT_DESCRIPTOR(MIDI_IN_CABLES)), .Type = DTYPE_AudioEndpoint},
 			.Subtype                  = DSUBTYPE_General,
 
-			.TotalEmbeddedJacks       = 0x02,
-			.AssociatedJackID         = {0x0a, 0x09}
+			.TotalEmbeddedJacks       = MIDI_IN_CABLES,
+			.AssociatedJackID         = {MIDI_REPEAT(MIDI_IN_CABLES, MIDI_JACK_ID_EMB_OUT)}
+		},
+
+	.Telemetry_Interface =
+		{
+			.Header                   = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface},
+
+			.InterfaceNumber          = 2,
+			.AlternateSetting         = 0,
+
+			.TotalEndpoints           = 1,
+
+			.Class                    = 0xFF,
+			.SubClass                 = 0x00,
+			.Protocol                 = 0x00,
+
+			.InterfaceStrIndex        = 0x08
+		},
+
+	.Telemetry_DataInEndpoint =
+		{
+			.Header                   = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+			.EndpointAddress          = (ENDPOINT_DESCRIPTOR_DIR_IN | TELEMETRY_IN_EPNUM),
+			.Attributes               = (EP_TYPE_BULK | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+			.EndpointSize             = TELEMETRY_IN_EPSIZE,
+			.PollingIntervalMS        = 0x00
 		}
 };
 
@@ -583,6 +535,12 @@ const USB_Descriptor_String_t PROGMEM MIDIOutInternalStringMIDI =
 	.UnicodeString          = L"MIDI-Out Internal"
 };
 
+const USB_Descriptor_String_t PROGMEM TelemetryStringMIDI =
+{
+	.Header                 = {.Size = USB_STRING_LEN(13), .Type = DTYPE_String},
+	.UnicodeString          = L"Chi Telemetry"
+};
+
 /** This function is called by the library when in device mode, and must be overridden (see library "USB Descriptors"
  *  documentation) by the application code so that the address and size of a requested descriptor can be given
  *  to the USB library. When the device receives a Get Descriptor request on the control endpoint, this function
@@ -674,6 +632,12 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 					Size    = pgm_read_byte(&MIDIOutInternalStringMIDI.Header.Size);
 				  }
 					break;
+				case 0x08:
+				  if (systemMode == 1) {
+					Address = (void*)&TelemetryStringMIDI;
+					Size    = pgm_read_byte(&TelemetryStringMIDI.Header.Size);
+				  }
+					break;
 			}
 			break;
 	}
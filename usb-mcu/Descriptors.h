@@ -75,6 +75,8 @@
 		#include <LUFA/Drivers/USB/USB.h>
 		#include <LUFA/Drivers/USB/Class/CDC.h>
 		#include <LUFA/Drivers/USB/Class/MIDI.h>
+
+		#include "midi-mux.h"
 		
 	/* Product-specific definitions: */
 		#define ARDUINO_UNO_PID			0x0001
@@ -98,8 +100,46 @@
 		#define MIDI_STREAM_IN_EPNUM        2
 		/** Endpoint number of the MIDI streaming data OUT endpoint, for host-to-device data transfers. */
 		#define MIDI_STREAM_OUT_EPNUM       1
-		/** Endpoint size in bytes of the Audio isochronous streaming data IN and OUT endpoints. */
-		#define MIDI_STREAM_EPSIZE          64
+		/** Endpoint size in bytes of the MIDI streaming data IN endpoint (double banked, 16 events per bank). */
+		#define MIDI_STREAM_IN_EPSIZE       64
+		/** Endpoint size in bytes of the MIDI streaming data OUT endpoint.  The 16u2 has 176 bytes of endpoint
+		 *  memory, so with the control endpoint (8) and the double banked IN endpoint (128) this has to be smaller.
+		 */
+		#define MIDI_STREAM_OUT_EPSIZE      32
+
+	/* Macros for the telemetry interface (MIDI mode) */
+		/** Endpoint number of the telemetry bulk IN endpoint (the Main MCU's telemetry cable, see midi-mux.h). */
+		#define TELEMETRY_IN_EPNUM          3
+		/** Endpoint size in bytes of the telemetry bulk IN endpoint - the 8 bytes of endpoint memory left
+		 *  over by the MIDI endpoints.
+		 */
+		#define TELEMETRY_IN_EPSIZE         8
+
+		/** Jack IDs - each cable has an embedded jack and the external jack it connects to. */
+		#define MIDI_JACK_ID_EMB_IN(Cable)  (0x01 + (Cable))
+		#define MIDI_JACK_ID_EXT_OUT(Cable) (0x11 + (Cable))
+		#define MIDI_JACK_ID_EXT_IN(Cable)  (0x21 + (Cable))
+		#define MIDI_JACK_ID_EMB_OUT(Cable) (0x31 + (Cable))
+
+		/** Expands M(n) for n = 0 to Count - 1, separated by commas (for initializers). */
+		#define MIDI_REPEAT(Count, M)       MIDI_REPEAT_(Count, M)
+		#define MIDI_REPEAT_(Count, M)      MIDI_REPEAT_##Count(M)
+		#define MIDI_REPEAT_1(M)            M(0)
+		#define MIDI_REPEAT_2(M)            MIDI_REPEAT_1(M), M(1)
+		#define MIDI_REPEAT_3(M)            MIDI_REPEAT_2(M), M(2)
+		#define MIDI_REPEAT_4(M)            MIDI_REPEAT_3(M), M(3)
+		#define MIDI_REPEAT_5(M)            MIDI_REPEAT_4(M), M(4)
+		#define MIDI_REPEAT_6(M)            MIDI_REPEAT_5(M), M(5)
+		#define MIDI_REPEAT_7(M)            MIDI_REPEAT_6(M), M(6)
+		#define MIDI_REPEAT_8(M)            MIDI_REPEAT_7(M), M(7)
+		#define MIDI_REPEAT_9(M)            MIDI_REPEAT_8(M), M(8)
+		#define MIDI_REPEAT_10(M)           MIDI_REPEAT_9(M), M(9)
+		#define MIDI_REPEAT_11(M)           MIDI_REPEAT_10(M), M(10)
+		#define MIDI_REPEAT_12(M)           MIDI_REPEAT_11(M), M(11)
+		#define MIDI_REPEAT_13(M)           MIDI_REPEAT_12(M), M(12)
+		#define MIDI_REPEAT_14(M)           MIDI_REPEAT_13(M), M(13)
+		#define MIDI_REPEAT_15(M)           MIDI_REPEAT_14(M), M(14)
+		#define MIDI_REPEAT_16(M)           MIDI_REPEAT_15(M), M(15)
 		
 	/* Type Defines for CDC */
 		/** Type define for the device configuration descriptor structure. This must be defined in the
@@ -120,23 +160,18 @@
 		} USB_Descriptor_ConfigurationCDC_t;
 
 	/* Type Defines for MIDI */
-		typedef struct
-		{
-			USB_Descriptor_Header_t   Header; /**< Regular descriptor header containing the descriptor's type and length */
-			uint8_t                   Subtype; /**< Sub type value used to distinguish between audio class specific descriptors */
-
-			uint8_t                   TotalEmbeddedJacks; /**< Total number of jacks inside this endpoint */
-			uint8_t                   AssociatedJackID[2]; /**< IDs of each jack inside the endpoint */
-		} USB_MIDI_DualJack_Endpoint_t;
-
-		typedef struct
-		{
-			USB_Descriptor_Header_t   Header; /**< Regular descriptor header containing the descriptor's type and length */
-			uint8_t                   Subtype; /**< Sub type value used to distinguish between audio class specific descriptors */
+		/** Macro for a class specific MIDI streaming endpoint descriptor with the given number of
+		 *  embedded jacks (one per virtual cable, in cable number order).
+		 */
+		#define MIDI_JACK_ENDPOINT_DESCRIPTOR(Jacks)                \
+		     struct                                                 \
+		     {                                                      \
+		          USB_Descriptor_Header_t Header;                   \
+		          uint8_t                 Subtype;                  \
+		          uint8_t                 TotalEmbeddedJacks;       \
+		          uint8_t                 AssociatedJackID[Jacks];  \
+		     }
 
-			uint8_t                   TotalEmbeddedJacks; /**< Total number of jacks inside this endpoint */
-			uint8_t                   AssociatedJackID[3]; /**< IDs of each jack inside the endpoint */
-		} USB_MIDI_TripleJack_Endpoint_t;
 
 		typedef struct
 		{
@@ -145,20 +180,16 @@
 			USB_Audio_Interface_AC_t              Audio_ControlInterface_SPC;
 			USB_Descriptor_Interface_t            Audio_StreamInterface;
 			USB_MIDI_AudioInterface_AS_t          Audio_StreamInterface_SPC;
-			USB_MIDI_In_Jack_t                    MIDI_In_Jack_Emb_to_MIDI_Out;
-			USB_MIDI_In_Jack_t                    MIDI_In_Jack_Emb_to_MIDI_Thru;
-			USB_MIDI_In_Jack_t                    MIDI_In_Jack_Emb_to_Internal;
-			USB_MIDI_In_Jack_t                    MIDI_In_Jack_Ext_src_MIDI_In;
-			USB_MIDI_In_Jack_t                    MIDI_In_Jack_Ext_src_Internal;
-			USB_MIDI_Out_Jack_t                   MIDI_Out_Jack_Emb_from_MIDI_In;
-			USB_MIDI_Out_Jack_t                   MIDI_Out_Jack_Emb_from_Internal;
-			USB_MIDI_Out_Jack_t                   MIDI_Out_Jack_Ext_dst_MIDI_Out;
-			USB_MIDI_Out_Jack_t                   MIDI_Out_Jack_Ext_dst_MIDI_Thru;
-			USB_MIDI_Out_Jack_t                   MIDI_Out_Jack_Ext_dst_Internal;
+			USB_MIDI_In_Jack_t                    MIDI_In_Jack_Emb[MIDI_OUT_CABLES];
+			USB_MIDI_Out_Jack_t                   MIDI_Out_Jack_Ext[MIDI_OUT_CABLES];
+			USB_MIDI_In_Jack_t                    MIDI_In_Jack_Ext[MIDI_IN_CABLES];
+			USB_MIDI_Out_Jack_t                   MIDI_Out_Jack_Emb[MIDI_IN_CABLES];
 			USB_Audio_StreamEndpoint_Std_t        MIDI_In_Jack_Endpoint;
-			USB_MIDI_TripleJack_Endpoint_t        MIDI_In_Jack_Endpoint_SPC;
+			MIDI_JACK_ENDPOINT_DESCRIPTOR(MIDI_OUT_CABLES) MIDI_In_Jack_Endpoint_SPC;
 			USB_Audio_StreamEndpoint_Std_t        MIDI_Out_Jack_Endpoint;
-			USB_MIDI_DualJack_Endpoint_t          MIDI_Out_Jack_Endpoint_SPC;
+			MIDI_JACK_ENDPOINT_DESCRIPTOR(MIDI_IN_CABLES)  MIDI_Out_Jack_Endpoint_SPC;
+			USB_Descriptor_Interface_t            Telemetry_Interface;
+			USB_Descriptor_Endpoint_t             Telemetry_DataInEndpoint;
 		} USB_Descriptor_ConfigurationMIDI_t;
 		
 	/* Function Prototypes: */
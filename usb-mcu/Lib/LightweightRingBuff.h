@@ -7,6 +7,7 @@
 */
 
 /*
+  Copyright 2018  Darcy Watkins (darcy [at] xstreamworship [dot] com)
   Copyright 2010  Dean Camera (dean [at] fourwalledcubicle [dot] com)
 
   Permission to use, copy, modify, distribute, and sell this 
@@ -31,37 +32,33 @@
 /** \file
  *
  *  Ultra lightweight ring buffer, for fast insertion/deletion.
+ *
+ *  Single producer / single consumer - one execution thread (main program thread or an ISR)
+ *  inserts and another removes.  Each side only writes its own index, so no atomic locks are
+ *  needed on an 8-bit AVR.  The storage is supplied by the user and must be a power of two
+ *  in size (up to 256), one element is kept free to tell a full buffer from an empty one.
  */
  
 #ifndef _ULW_RING_BUFF_H_
 #define _ULW_RING_BUFF_H_
 
 	/* Includes: */
-		#include <util/atomic.h>
-	
 		#include <stdint.h>
 		#include <stdbool.h>
 
 	/* Defines: */
-		/** Size of each ring buffer, in data elements - must be between 1 and 255. */
-		#define BUFFER_SIZE         128
-		
-		/** Maximum number of data elements to buffer before forcing a flush. 
-		 *  Must be less than BUFFER_SIZE
-		 */
-		#define BUFFER_NEARLY_FULL	96
-		
 		/** Type of data to store into the buffer. */
 		#define RingBuff_Data_t     uint8_t
 
 		/** Datatype which may be used to store the count of data stored in a buffer, retrieved
 		 *  via a call to \ref RingBuffer_GetCount().
 		 */
-		#if (BUFFER_SIZE <= 0xFF)
-			#define RingBuff_Count_t   uint8_t
-		#else
-			#define RingBuff_Count_t   uint16_t
-		#endif
+		#define RingBuff_Count_t    uint8_t
+
+		/** Compiler barrier - the data must be in place before the index that hands it over
+		 *  to the other thread is updated (and read out before it is handed back).
+		 */
+		#define RINGBUFF_BARRIER()  __asm__ __volatile__ ("" ::: "memory")
 
 	/* Type Defines: */
 		/** Type define for a new ring buffer object. Buffers should be initialized via a call to
@@ -69,54 +66,51 @@
 		 */
 		typedef struct
 		{
-			RingBuff_Data_t  Buffer[BUFFER_SIZE]; /**< Internal ring buffer data, referenced by the buffer pointers. */
-			RingBuff_Data_t* In; /**< Current storage location in the circular buffer */
-			RingBuff_Data_t* Out; /**< Current retrieval location in the circular buffer */
-			RingBuff_Count_t Count;
+			RingBuff_Data_t*          Buffer; /**< Storage, a power of two elements in size. */
+			RingBuff_Count_t          Mask; /**< Size of the storage less one. */
+			volatile RingBuff_Count_t In; /**< Next storage index, written by the producer only. */
+			volatile RingBuff_Count_t Out; /**< Next retrieval index, written by the consumer only. */
 		} RingBuff_t;
 	
 	/* Inline Functions: */
 		/** Initializes a ring buffer ready for use. Buffers must be initialized via this function
-		 *  before any operations are called upon them. Already initialized buffers may be reset
-		 *  by re-initializing them using this function.
+		 *  before any operations are called upon them, while neither thread is using them.
 		 *
-		 *  \param[out] Buffer  Pointer to a ring buffer structure to initialize
+		 *  \param[out] Buffer   Pointer to a ring buffer structure to initialize
+		 *  \param[in]  Storage  Storage for the buffer data
+		 *  \param[in]  Size     Size of the storage in elements, a power of two up to 256
 		 */
-		static inline void RingBuffer_InitBuffer(RingBuff_t* const Buffer)
+		static inline void RingBuffer_InitBuffer(RingBuff_t* const Buffer,
+		                                         RingBuff_Data_t* const Storage,
+		                                         const uint16_t Size)
 		{
-			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-			{
-				Buffer->In  = Buffer->Buffer;
-				Buffer->Out = Buffer->Buffer;
-			}
+			Buffer->Buffer = Storage;
+			Buffer->Mask   = Size - 1;
+			Buffer->In     = 0;
+			Buffer->Out    = 0;
 		}
 		
-		/** Retrieves the minimum number of bytes stored in a particular buffer. This value is computed
-		 *  by entering an atomic lock on the buffer while the IN and OUT locations are fetched, so that
-		 *  the buffer cannot be modified while the computation takes place. This value should be cached
-		 *  when reading out the contents of the buffer, so that as small a time as possible is spent
-		 *  in an atomic lock.
-		 *
-		 *  \note The value returned by this function is guaranteed to only be the minimum number of bytes
-		 *        stored in the given buffer; this value may change as other threads write new data and so
-		 *        the returned number should be used only to determine how many successive reads may safely
-		 *        be performed on the buffer.
+		/** Retrieves the minimum number of elements stored in a particular buffer. The producer
+		 *  may add more at any time, so this should be used only to determine how many successive
+		 *  reads may safely be performed on the buffer.
 		 *
 		 *  \param[in] Buffer  Pointer to a ring buffer structure whose count is to be computed
 		 */
 		static inline RingBuff_Count_t RingBuffer_GetCount(RingBuff_t* const Buffer)
 		{
-			RingBuff_Count_t Count;
-			
-			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-			{
-				Count = Buffer->Count;
-			}
-			
-			return Count;
+			return (Buffer->In - Buffer->Out) & Buffer->Mask;
+		}
+		
+		/** Retrieves the minimum number of elements that may be inserted into a particular buffer.
+		 *
+		 *  \param[in] Buffer  Pointer to a ring buffer structure whose free space is to be computed
+		 */
+		static inline RingBuff_Count_t RingBuffer_GetFree(RingBuff_t* const Buffer)
+		{
+			return Buffer->Mask - RingBuffer_GetCount(Buffer);
 		}
 		
-		/** Atomically determines if the specified ring buffer contains any free space. This should
+		/** Determines if the specified ring buffer contains any free space. This should
 		 *  be tested before storing data to the buffer, to ensure that no data is lost due to a
 		 *  buffer overrun.
 		 *
@@ -126,31 +120,23 @@
 		 */		 
 		static inline bool RingBuffer_IsFull(RingBuff_t* const Buffer)
 		{
-			return (RingBuffer_GetCount(Buffer) == BUFFER_SIZE);
+			return (RingBuffer_GetCount(Buffer) == Buffer->Mask);
 		}
 
-		/** Atomically determines if the specified ring buffer contains any data. This should
+		/** Determines if the specified ring buffer contains any data. This should
 		 *  be tested before removing data from the buffer, to ensure that the buffer does not
 		 *  underflow.
 		 *
-		 *  If the data is to be removed in a loop, store the total number of bytes stored in the
-		 *  buffer (via a call to the \ref RingBuffer_GetCount() function) in a temporary variable
-		 *  to reduce the time spent in atomicity locks.
+		 *  \param[in,out] Buffer  Pointer to a ring buffer structure to remove from
 		 *
-		 *  \param[in,out] Buffer  Pointer to a ring buffer structure to insert into
-		 *
-		 *  \return Boolean true if the buffer contains no free space, false otherwise
+		 *  \return Boolean true if the buffer contains no data, false otherwise
 		 */		 
 		static inline bool RingBuffer_IsEmpty(RingBuff_t* const Buffer)
 		{
-			return (RingBuffer_GetCount(Buffer) == 0);
+			return (Buffer->In == Buffer->Out);
 		}
 
-		/** Inserts an element into the ring buffer.
-		 *
-		 *  \note Only one execution thread (main program thread or an ISR) may insert into a single buffer
-		 *        otherwise data corruption may occur. Insertion and removal may occur from different execution
-		 *        threads.
+		/** Inserts an element into the ring buffer (producer only).
 		 *
 		 *  \param[in,out] Buffer  Pointer to a ring buffer structure to insert into
 		 *  \param[in]     Data    Data element to insert into the buffer
@@ -158,22 +144,14 @@
 		static inline void RingBuffer_Insert(RingBuff_t* const Buffer,
 		                                     const RingBuff_Data_t Data)
 		{
-			*Buffer->In = Data;
-			
-			if (++Buffer->In == &Buffer->Buffer[BUFFER_SIZE])
-			  Buffer->In = Buffer->Buffer;
+			RingBuff_Count_t In = Buffer->In;
 
-			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-			{
-				Buffer->Count++;
-			}
+			Buffer->Buffer[In] = Data;
+			RINGBUFF_BARRIER();
+			Buffer->In = (In + 1) & Buffer->Mask;
 		}
 
-		/** Removes an element from the ring buffer.
-		 *
-		 *  \note Only one execution thread (main program thread or an ISR) may remove from a single buffer
-		 *        otherwise data corruption may occur. Insertion and removal may occur from different execution
-		 *        threads.
+		/** Removes an element from the ring buffer (consumer only).
 		 *
 		 *  \param[in,out] Buffer  Pointer to a ring buffer structure to retrieve from
 		 *
@@ -181,17 +159,78 @@
 		 */
 		static inline RingBuff_Data_t RingBuffer_Remove(RingBuff_t* const Buffer)
 		{
-			RingBuff_Data_t Data = *Buffer->Out;
-			
-			if (++Buffer->Out == &Buffer->Buffer[BUFFER_SIZE])
-			  Buffer->Out = Buffer->Buffer;
+			RingBuff_Count_t Out = Buffer->Out;
+			RingBuff_Data_t Data = Buffer->Buffer[Out];
 
-			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-			{
-				Buffer->Count--;
-			}
+			RINGBUFF_BARRIER();
+			Buffer->Out = (Out + 1) & Buffer->Mask;
 			
 			return Data;
 		}
 
+		/** Gets the contiguous run of stored elements starting at the next to be removed (consumer
+		 *  only), so they can be processed in place.  Elements past the end of the storage are
+		 *  returned by the next call, after \ref RingBuffer_Commit().
+		 *
+		 *  \param[in]  Buffer  Pointer to a ring buffer structure to retrieve from
+		 *  \param[out] Data    Set to the first element of the run
+		 *
+		 *  \return Number of elements in the run
+		 */
+		static inline RingBuff_Count_t RingBuffer_Peek(RingBuff_t* const Buffer,
+		                                               RingBuff_Data_t** const Data)
+		{
+			RingBuff_Count_t In  = Buffer->In;
+			RingBuff_Count_t Out = Buffer->Out;
+
+			*Data = &Buffer->Buffer[Out];
+			if (In >= Out)
+			  return In - Out;
+			return Buffer->Mask - Out + 1;
+		}
+
+		/** Removes elements from the ring buffer after they were processed in place (consumer only).
+		 *
+		 *  \param[in,out] Buffer  Pointer to a ring buffer structure to retrieve from
+		 *  \param[in]     Count   Number of elements to remove, no more than \ref RingBuffer_Peek() returned
+		 */
+		static inline void RingBuffer_Commit(RingBuff_t* const Buffer,
+		                                     const RingBuff_Count_t Count)
+		{
+			RINGBUFF_BARRIER();
+			Buffer->Out = (Buffer->Out + Count) & Buffer->Mask;
+		}
+
+		/** Gets the contiguous run of free elements starting at the next to be stored (producer
+		 *  only), so they can be filled in place.
+		 *
+		 *  \param[in]  Buffer  Pointer to a ring buffer structure to insert into
+		 *  \param[out] Data    Set to the first element of the run
+		 *
+		 *  \return Number of elements in the run
+		 */
+		static inline RingBuff_Count_t RingBuffer_Reserve(RingBuff_t* const Buffer,
+		                                                  RingBuff_Data_t** const Data)
+		{
+			RingBuff_Count_t In  = Buffer->In;
+			RingBuff_Count_t Out = Buffer->Out;
+
+			*Data = &Buffer->Buffer[In];
+			if (Out > In)
+			  return Out - In - 1;
+			return Buffer->Mask - In + (Out ? 1 : 0);
+		}
+
+		/** Inserts elements into the ring buffer after they were filled in place (producer only).
+		 *
+		 *  \param[in,out] Buffer  Pointer to a ring buffer structure to insert into
+		 *  \param[in]     Count   Number of elements to insert, no more than \ref RingBuffer_Reserve() returned
+		 */
+		static inline void RingBuffer_Publish(RingBuff_t* const Buffer,
+		                                      const RingBuff_Count_t Count)
+		{
+			RINGBUFF_BARRIER();
+			Buffer->In = (Buffer->In + Count) & Buffer->Mask;
+		}
+
 #endif
@@ -0,0 +1,160 @@
+/*
+     Chi-1p-40 USB-MCU Firmware Project
+     Copyright (C) 2018 Darcy Watkins
+     darcy [at] xstreamworship [dot] com
+     http://xstreamworship.com
+*/
+/*
+  Copyright 2018 Darcy Watkins (darcy [at] xstreamworship [dot] com)
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Host (Linux) check of the USB descriptors in Descriptors.c, built against the LUFA descriptor headers.
+ *
+ *  The configuration descriptor of each mode is fetched through CALLBACK_USB_GetDescriptor and parsed
+ *  the way a host does, as a flat run of descriptors:
+ *  - The descriptors exactly fill wTotalLength, and there are bNumInterfaces interfaces, each followed
+ *    by bNumEndpoints endpoints.
+ *  - The class specific header of each audio interface (AudioControl and MIDIStreaming) has a
+ *    wTotalLength that covers exactly the descriptors up to the next interface.
+ *  - The AudioControl header lists the MIDIStreaming interfaces.
+ */
+
+#include <stdio.h>
+
+#include "Descriptors.h"
+
+#define DESC_LENGTH     0
+#define DESC_TYPE       1
+#define DESC_SUBTYPE    2
+
+static unsigned failures;
+
+uchar systemMode;
+
+static void fail(const char *test, long index, const char *what) {
+  if (failures++ < 10)
+    fprintf(stderr, "FAIL %s: %s at %ld\n", test, what, index);
+}
+
+static uint16_t word(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+/* Offset of the next standard interface descriptor after the one at Offset, or the end. */
+static uint16_t nextInterface(const uint8_t *config, uint16_t total, uint16_t offset) {
+  for (offset += config[offset + DESC_LENGTH]; offset < total; offset += config[offset + DESC_LENGTH]) {
+    if (config[offset + DESC_TYPE] == DTYPE_Interface)
+      break;
+  }
+  return offset;
+}
+
+static int isInterface(const uint8_t *config, uint16_t total, uint8_t number, uint8_t subClass) {
+  uint16_t offset;
+  for (offset = 0; offset < total; offset += config[offset + DESC_LENGTH]) {
+    const uint8_t *d = config + offset;
+    if ((d[DESC_TYPE] == DTYPE_Interface) && (d[2] == number) && (d[5] == 0x01) && (d[6] == subClass))
+      return 1;
+  }
+  return 0;
+}
+
+static void configuration(const char *test, uchar mode) {
+  const void *address;
+  const uint8_t *config;
+  uint16_t size, total, offset;
+  uint8_t interfaces = 0, endpoints = 0;
+  const uint8_t *interface = NULL;
+
+  systemMode = mode;
+  size = CALLBACK_USB_GetDescriptor(DTYPE_Configuration << 8, 0, (void **)&address);
+  config = address;
+  if (!config || (size == NO_DESCRIPTOR)) {
+    fail(test, 0, "no configuration descriptor");
+    return;
+  }
+  total = word(config + 2);
+  if (total != size)
+    fail(test, 0, "wTotalLength is not the descriptor size");
+
+  /* Walk the descriptors, each must fit and they must end exactly at wTotalLength */
+  for (offset = 0; offset < total; offset += config[offset + DESC_LENGTH]) {
+    const uint8_t *d = config + offset;
+    if ((d[DESC_LENGTH] < 2) || (offset + d[DESC_LENGTH] > total)) {
+      fail(test, offset, "descriptor length overruns wTotalLength");
+      return;
+    }
+    if ((offset == 0) != (d[DESC_TYPE] == DTYPE_Configuration))
+      fail(test, offset, "configuration header misplaced");
+
+    if (d[DESC_TYPE] == DTYPE_Interface) {
+      if (interface && (endpoints != interface[4]))
+        fail(test, offset, "bNumEndpoints mismatch");
+      interface = d;
+      endpoints = 0;
+      if (d[3] == 0)
+        interfaces++;
+
+      /* Audio interfaces - the class specific header follows and spans up to the next interface */
+      if ((d[5] == 0x01) && ((d[6] == 0x01) || (d[6] == 0x03))) {
+        const uint8_t *h = d + d[DESC_LENGTH];
+        uint16_t start = offset + d[DESC_LENGTH];
+        if ((start >= total) || (h[DESC_TYPE] != DTYPE_AudioInterface) || (h[DESC_SUBTYPE] != DSUBTYPE_Header)) {
+          fail(test, offset, "audio interface without a class specific header");
+          continue;
+        }
+        if (word(h + 5) != nextInterface(config, total, offset) - start)
+          fail(test, start, "class specific wTotalLength does not end at the next interface");
+        if (d[6] == 0x01) {
+          uint8_t i;
+          for (i = 0; i < h[7]; i++) {
+            if (!isInterface(config, total, h[8 + i], 0x03))
+              fail(test, start, "AudioControl lists a missing MIDIStreaming interface");
+          }
+        }
+      }
+    } else if (d[DESC_TYPE] == DTYPE_Endpoint) {
+      if (!interface)
+        fail(test, offset, "endpoint outside an interface");
+      endpoints++;
+    }
+  }
+  if (interface && (endpoints != interface[4]))
+    fail(test, offset, "bNumEndpoints mismatch");
+  if (interfaces != config[4])
+    fail(test, 0, "bNumInterfaces mismatch");
+  printf("%s: %u bytes, %u interfaces\n", test, total, interfaces);
+}
+
+int main(void) {
+  printf("%d cables to the host, %d from it\n", MIDI_IN_CABLES, MIDI_OUT_CABLES);
+  configuration("midi", 1);
+  configuration("serial", 0);
+
+  if (failures) {
+    printf("%u failures\n", failures);
+    return 1;
+  }
+  printf("pass\n");
+  return 0;
+}
@@ -0,0 +1,10 @@
+/* Host stand-in for the avr-libc program memory API (descriptors live in RAM on the host). */
+#ifndef _HOST_PGMSPACE_H_
+#define _HOST_PGMSPACE_H_
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(Address)  (*(const uint8_t *)(Address))
+
+#endif
@@ -0,0 +1,31 @@
+/* Forced include for building Descriptors.c on the host.  Only the descriptor definitions of LUFA
+ * are wanted, so the include guards of the headers that drag in the AVR USB controller (and of
+ * usb-mcu.h) are claimed here, and what Descriptors.c uses from them is declared instead.
+ */
+#ifndef _DESCRIPTORS_HOST_H_
+#define _DESCRIPTORS_HOST_H_
+
+#define __USB_H__
+#define __USBDEVICE_H__
+#define _CDC_CLASS_H_
+#define _MIDI_CLASS_H_
+#define _USB_MCU_H_
+
+#define __INCLUDE_FROM_USB_DRIVER
+#define __INCLUDE_FROM_CDC_DRIVER
+#define __INCLUDE_FROM_MIDI_DRIVER
+
+#include <LUFA/Drivers/USB/HighLevel/StdDescriptors.h>
+#include <LUFA/Drivers/USB/Class/Common/CDC.h>
+#include <LUFA/Drivers/USB/Class/Common/MIDI.h>
+
+/* From LowLevel/USBController.h */
+#define EP_TYPE_CONTROL      0x00
+#define EP_TYPE_ISOCHRONOUS  0x01
+#define EP_TYPE_BULK         0x02
+#define EP_TYPE_INTERRUPT    0x03
+
+typedef uint8_t uchar;
+extern uchar systemMode;
+
+#endif
@@ -0,0 +1,676 @@
+/*
+     Chi-1p-40 USB-MCU Firmware Project
+     Copyright (C) 2018 Darcy Watkins
+     darcy [at] xstreamworship [dot] com
+     http://xstreamworship.com
+*/
+/*
+  Copyright 2018 Darcy Watkins (darcy [at] xstreamworship [dot] com)
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Host (Linux) property test and benchmark of the USB <-> serial MIDI translators in midi-mux.c.
+ *
+ *  Usage:
+ *    midi-mux-test [-n events] [-s seed] [file ...]
+ *
+ *  - Round trip: random USB MIDI event streams (channel, system common, realtime and SysEx, interleaved
+ *    over the cables) are translated to the serial link and back, and must come back unchanged.
+ *  - Fuzz: random serial bytes (biased towards escapes, status bytes and cable IDs) must only ever
+ *    produce well formed USB MIDI events, and arbitrary event packets must only ever produce a serial
+ *    stream with valid escapes.
+ *  - Telemetry: raw bytes on the telemetry cable, inserted into a round trip stream, must come out in
+ *    the telemetry buffer unchanged without disturbing the events.
+ *  - Held: which serial bytes complete an event to the host, are held in one, or take no part in one.
+ *  - Credit: grants from the Main MCU, even in the middle of a message, make the cable flow controlled,
+ *    holding back events beyond the credit, and don't disturb the events from the serial link.  A credit
+ *    reset drops the credit left, and the cable stays flow controlled until the next grant.
+ *  - Recorded: a built in capture of the Main MCU's serial output, plus any files given (raw bytes of
+ *    the serial link), are translated to USB events and back again, which must reproduce the events.
+ *  - Benchmark: bytes per second in each direction and the worst case (host) cycles per byte.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "midi-mux.h"
+
+#define MAX_EVENTS   (1L << 20)
+
+typedef struct {
+  uint8_t b[4];
+} event_t;
+
+static unsigned failures;
+
+static void fail(const char *test, long index, const char *what) {
+  if (failures++ < 10)
+    fprintf(stderr, "FAIL %s: %s at %ld\n", test, what, index);
+}
+
+static uint32_t rng;
+
+static uint32_t rnd(uint32_t n) {
+  /* xorshift32 */
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng % n;
+}
+
+static uint64_t cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static double seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Serial link stream, filled from a ring buffer drained after each event. */
+typedef struct {
+  uint8_t *data;
+  long len;
+  long size;
+} stream_t;
+
+static RingBuff_t link;
+static RingBuff_Data_t linkData[256];
+
+static void streamPut(stream_t *s, uint8_t b) {
+  if (s->len == s->size) {
+    s->size = s->size ? s->size * 2 : 4096;
+    s->data = realloc(s->data, s->size);
+  }
+  s->data[s->len++] = b;
+}
+
+static void encode(const event_t *events, long count, stream_t *s) {
+  long i;
+  for (i = 0; i < count; i++) {
+    if (RingBuffer_GetFree(&link) < MIDI_MUX_MAX_SERIAL)
+      fail("encode", i, "buffer reserve");
+    parseUSBMidiMessage(events[i].b, &link);
+    while (!RingBuffer_IsEmpty(&link))
+      streamPut(s, RingBuffer_Remove(&link));
+  }
+}
+
+static long decode(const uint8_t *data, long len, event_t *events, long max) {
+  long count = 0;
+  long i;
+  for (i = 0; i < len; i++) {
+    if (parseSerialMidiMessage(data[i], events[count].b) && (++count == max))
+      break;
+  }
+  return count;
+}
+
+/* Checks a USB MIDI event from the serial link is well formed. */
+static const char *checkEvent(const uint8_t *e) {
+  uint8_t cable = e[0] >> 4;
+  uint8_t cin = e[0] & 0x0f;
+  if (cable >= MIDI_IN_CABLES)
+    return "cable out of range";
+  switch (cin) {
+    case 2:
+      if (((e[1] != 0xf1) && (e[1] != 0xf3)) || (e[2] & 0x80) || e[3])
+        return "bad two byte system common";
+      break;
+    case 3:
+      if ((e[1] != 0xf2) || (e[2] & 0x80) || (e[3] & 0x80))
+        return "bad three byte system common";
+      break;
+    case 4:
+      if (((e[1] != 0xf0) && (e[1] & 0x80)) || (e[2] & 0x80) || (e[3] & 0x80))
+        return "bad SysEx";
+      break;
+    case 5:
+      if (((e[1] != 0xf6) && (e[1] != 0xf7)) || e[2] || e[3])
+        return "bad single byte system common";
+      break;
+    case 6:
+      if (((e[1] != 0xf0) && (e[1] & 0x80)) || (e[2] != 0xf7) || e[3])
+        return "bad SysEx end (2)";
+      break;
+    case 7:
+      if (((e[1] != 0xf0) && (e[1] & 0x80)) || (e[2] & 0x80) || (e[3] != 0xf7))
+        return "bad SysEx end (3)";
+      break;
+    case 8: case 9: case 10: case 11: case 14:
+      if (((e[1] >> 4) != cin) || (e[2] & 0x80) || (e[3] & 0x80))
+        return "bad channel message";
+      break;
+    case 12: case 13:
+      if (((e[1] >> 4) != cin) || (e[2] & 0x80) || e[3])
+        return "bad two byte channel message";
+      break;
+    case 15:
+      if (((e[1] < 0xf8) && (e[1] != 0xfd)) || e[2] || e[3])
+        return "bad single byte";
+      break;
+    default:
+      return "bad code index";
+  }
+  return NULL;
+}
+
+/* Random well formed USB MIDI event stream over the cables the serial link carries to the host. */
+static long generate(event_t *events, long count) {
+  static const uint8_t realtime[] = { 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+  int sysExLeft[MIDI_IN_CABLES] = { 0 };
+  int sysExStarted[MIDI_IN_CABLES] = { 0 };
+  long n = 0;
+
+  while (n < count) {
+    uint8_t cable = rnd(MIDI_IN_CABLES);
+    uint8_t *e = events[n++].b;
+    uint8_t type = rnd(16);
+    memset(e, 0, 4);
+
+    if (type == 0) {
+      e[0] = 0x0f | (cable << 4);
+      e[1] = realtime[rnd(sizeof(realtime))];
+    } else if (sysExLeft[cable] || (type == 1)) {
+      /* SysEx, one packet at a time (other cables and realtime may come between them). */
+      uint8_t i = 1;
+      if (!sysExStarted[cable]) {
+        sysExStarted[cable] = 1;
+        sysExLeft[cable] = rnd(40) + 1;	/* data bytes and the end */
+        e[i++] = 0xf0;
+      }
+      for (; i < 4; i++) {
+        if (--sysExLeft[cable] == 0) {
+          e[i] = 0xf7;
+          sysExStarted[cable] = 0;
+          break;
+        }
+        e[i] = rnd(0x80);
+      }
+      e[0] = ((i < 4) ? (i + 4) : 4) | (cable << 4);
+    } else if (type == 2) {
+      static const uint8_t common[] = { 0xf1, 0xf2, 0xf3, 0xf6 };
+      e[1] = common[rnd(sizeof(common))];
+      switch (e[1]) {
+        case 0xf2: e[0] = 3; e[2] = rnd(0x80); e[3] = rnd(0x80); break;
+        case 0xf6: e[0] = 5; break;
+        default: e[0] = 2; e[2] = rnd(0x80); break;
+      }
+      e[0] |= cable << 4;
+    } else {
+      e[1] = 0x80 + rnd(0x70);
+      e[0] = (e[1] >> 4) | (cable << 4);
+      e[2] = rnd(0x80);
+      if ((e[1] & 0xe0) != 0xc0)
+        e[3] = rnd(0x80);
+    }
+  }
+  return n;
+}
+
+static void roundTrip(long count) {
+  event_t *sent = calloc(count, sizeof(event_t));
+  event_t *got = calloc(count + 1, sizeof(event_t));
+  stream_t s = { 0 };
+  long n, i;
+
+  midiMuxInit();
+  generate(sent, count);
+  encode(sent, count, &s);
+  n = decode(s.data, s.len, got, count + 1);
+  if (n != count)
+    fail("round trip", n, "event count");
+  for (i = 0; (i < n) && (i < count); i++) {
+    if (memcmp(sent[i].b, got[i].b, 4)) {
+      fail("round trip", i, "event differs");
+      break;
+    }
+  }
+  printf("round trip: %ld events, %ld serial bytes\n", count, s.len);
+  free(s.data);
+  free(sent);
+  free(got);
+}
+
+/* Round trip with telemetry (all byte values) inserted before some of the cable changes. */
+static void telemetry(long count) {
+  static RingBuff_Data_t telemetryData[64];
+  RingBuff_t telemetryBuffer;
+  event_t *sent = calloc(count, sizeof(event_t));
+  event_t *got = calloc(count + 1, sizeof(event_t));
+  stream_t s = { 0 }, mixed = { 0 }, raw = { 0 }, out = { 0 };
+  long n = 0, i;
+
+  midiMuxInit();
+  generate(sent, count);
+  encode(sent, count, &s);
+  for (i = 0; i < s.len; i++) {
+    if ((s.data[i] == 0xfd) && (i + 1 < s.len) && (s.data[i + 1] != 0xfd) && !rnd(4)) {
+      /* a cable change - telemetry goes in first */
+      uint8_t len = rnd(20);
+      streamPut(&mixed, 0xfd);
+      streamPut(&mixed, MIDI_TELEMETRY_CABLE);
+      while (len--) {
+        uint8_t b = (rnd(4) == 0) ? 0xfd : rnd(0x100);
+        streamPut(&raw, b);
+        if (b == 0xfd)
+          streamPut(&mixed, 0xfd);
+        streamPut(&mixed, b);
+      }
+    }
+    streamPut(&mixed, s.data[i]);
+    if (s.data[i] == 0xfd)
+      streamPut(&mixed, s.data[++i]);	/* rest of the escape */
+  }
+
+  RingBuffer_InitBuffer(&telemetryBuffer, telemetryData, sizeof(telemetryData));
+  midiMuxInit();
+  midiMuxTelemetry(&telemetryBuffer);
+  midiTelemetryLost = 0;
+  for (i = 0; i < mixed.len; i++) {
+    if (parseSerialMidiMessage(mixed.data[i], got[n].b) && (++n > count))
+      break;
+    while (!RingBuffer_IsEmpty(&telemetryBuffer))
+      streamPut(&out, RingBuffer_Remove(&telemetryBuffer));
+  }
+  if (n != count)
+    fail("telemetry", n, "event count");
+  for (i = 0; (i < n) && (i < count); i++) {
+    if (memcmp(sent[i].b, got[i].b, 4)) {
+      fail("telemetry", i, "event differs");
+      break;
+    }
+  }
+  if ((out.len != raw.len) || (raw.len && memcmp(out.data, raw.data, raw.len)))
+    fail("telemetry", out.len, "telemetry differs");
+  if (midiTelemetryLost)
+    fail("telemetry", midiTelemetryLost, "lost with room");
+
+  /* Not drained - the bytes that don't fit are counted as lost. */
+  parseSerialMidiMessage(0xfd, got[0].b);
+  parseSerialMidiMessage(MIDI_TELEMETRY_CABLE, got[0].b);
+  for (i = 0; i < (long)sizeof(telemetryData) + 10; i++)
+    parseSerialMidiMessage(0x55, got[0].b);
+  if (midiTelemetryLost != 11)
+    fail("telemetry", midiTelemetryLost, "lost count");
+  printf("telemetry: %ld bytes in %ld serial bytes\n", raw.len, mixed.len);
+  midiMuxTelemetry(NULL);
+  free(s.data);
+  free(mixed.data);
+  free(raw.data);
+  free(out.data);
+  free(sent);
+  free(got);
+}
+
+static void fuzzSerial(long len) {
+  static const uint8_t special[] = { 0xfd, 0xfd, 0xf0, 0xf7, 0xf6, 0xf4, 0xf8, 0x90, 0xc0, 0xf2, 0xf1 };
+  uint8_t e[4];
+  long i, events = 0;
+
+  midiMuxInit();
+  for (i = 0; i < len; i++) {
+    uint8_t b;
+    switch (rnd(4)) {
+      case 0: b = special[rnd(sizeof(special))]; break;
+      case 1: b = rnd(MIDI_IN_CABLES + 1); break;	/* cable IDs (after an escape) */
+      default: b = rnd(0x100); break;
+    }
+    if (parseSerialMidiMessage(b, e)) {
+      const char *err = checkEvent(e);
+      events++;
+      if (err)
+        fail("fuzz serial", i, err);
+    }
+  }
+  printf("fuzz serial: %ld bytes, %ld events\n", len, events);
+}
+
+static void fuzzUSB(long count) {
+  stream_t s = { 0 };
+  long i;
+
+  midiMuxInit();
+  for (i = 0; i < count; i++) {
+    event_t e;
+    uint8_t j;
+    for (j = 0; j < 4; j++)
+      e.b[j] = (rnd(4) == 0) ? 0xfd : rnd(0x100);
+    encode(&e, 1, &s);
+  }
+  /* Every escape must be a cable change or an escaped 0xfd. */
+  for (i = 0; i < s.len; i++) {
+    if (s.data[i] == 0xfd) {
+      if ((i + 1 == s.len) || ((s.data[i + 1] != 0xfd) && (s.data[i + 1] & 0xf0))) {
+        fail("fuzz USB", i, "bad escape");
+        break;
+      }
+      i++;
+    }
+  }
+  printf("fuzz USB: %ld packets, %ld serial bytes\n", count, s.len);
+  free(s.data);
+}
+
+/* Route table - the defaults, and a drop mask / loop back set as by REQ_SetMidiRoute. */
+static void routes(void) {
+  static const uint8_t sensing[4] = { 0x0f, 0xfe, 0, 0 }, clock[4] = { 0x0f, 0xf8, 0, 0 };
+  static const uint8_t note[4] = { 0x09, 0x90, 60, 100 }, sysex[4] = { 0x04, 0xf0, 0x7d, 0x01 };
+  uint8_t e[4];
+  uint8_t c;
+
+  midiMuxInit();
+  if (midiRouteLoops())
+    fail("routes", 0, "loops by default");
+  for (c = 0; c < MIDI_OUT_CABLES; c++) {
+    memcpy(e, sensing, 4);
+    e[0] |= c << 4;
+    if (midiRoute(e) != (c ? MIDI_ROUTE_SERIAL : 0))
+      fail("routes", c, "default active sensing");
+    memcpy(e, note, 4);
+    e[0] |= c << 4;
+    if (midiRoute(e) != MIDI_ROUTE_SERIAL)
+      fail("routes", c, "default note");
+  }
+  memcpy(e, note, 4);
+  e[0] |= MIDI_OUT_CABLES << 4;
+  if ((MIDI_OUT_CABLES < 16) && midiRoute(e))
+    fail("routes", MIDI_OUT_CABLES, "cable out of range");
+
+  c = MIDI_OUT_CABLES - 1;
+  midiRoutes[c].Drop = MIDI_DROP_CLOCK | MIDI_DROP_CIN(0x04) | MIDI_DROP_CIN(0x07);
+  midiRoutes[c].Route = MIDI_ROUTE_LOOPBACK | MIDI_ROUTE_LOOP_CABLE(MIDI_IN_CABLES - 1);
+  if (!midiRouteLoops())
+    fail("routes", c, "loop back not seen");
+  memcpy(e, clock, 4);
+  e[0] |= c << 4;
+  if (midiRoute(e))
+    fail("routes", c, "clock not dropped");
+  memcpy(e, sysex, 4);
+  e[0] |= c << 4;
+  if (midiRoute(e))
+    fail("routes", c, "SysEx not dropped");
+  memcpy(e, note, 4);
+  e[0] |= c << 4;
+  if (midiRoute(e) != midiRoutes[c].Route)
+    fail("routes", c, "note not looped back");
+  printf("routes: %d cables\n", MIDI_OUT_CABLES);
+  midiMuxInit();
+}
+
+/* Feeds a serial stream, returning the number of events (the last one in e). */
+static int feed(const uint8_t *data, int len, uint8_t *e) {
+  int events = 0;
+  while (len--)
+    events += parseSerialMidiMessage(*(data++), e);
+  return events;
+}
+
+/* Which serial bytes take part in an event to the host - completing it, or held in it (latency probe). */
+static void held(void) {
+  static const struct {
+    uint8_t b;
+    char what;	/* 'e' completes an event, 'h' is held, '-' neither */
+  } bytes[] = {
+    { 0x90, 'h' }, { 60, 'h' }, { 100, 'e' }, { 61, 'h' }, { 100, 'e' }, { 0xf8, 'e' },
+    { 0xf6, 'e' }, { 0x10, '-' }, { 0xfd, '-' }, { MIDI_TELEMETRY_CABLE, '-' }, { 0x42, '-' },
+    { 0xfd, '-' }, { 0x00, '-' }, { 0xfd, '-' }, { MIDI_MUX_CREDIT(1, 0), '-' },
+    { 0xf0, 'h' }, { 1, 'h' }, { 2, 'e' }, { 3, 'h' }, { 0xf7, 'e' }, { 0xfd, '-' }, { 0xfd, 'e' },
+  };
+  uint8_t e[4];
+  unsigned i;
+
+  midiMuxInit();
+  for (i = 0; i < sizeof(bytes) / sizeof(bytes[0]); i++) {
+    char what = parseSerialMidiMessage(bytes[i].b, e) ? 'e' : (midiMuxHeld() ? 'h' : '-');
+    if (what != bytes[i].what)
+      fail("held", i, "byte taken wrongly");
+  }
+  midiMuxInit();
+  printf("held: %u bytes\n", i);
+}
+
+/* Credit based flow control of the cables from the host. */
+static void credits(void) {
+  const uint8_t c = MIDI_OUT_CABLES - 1;
+  const uint8_t grant[] = { 0xfd, MIDI_MUX_CREDIT(1, c) };
+  const uint8_t most[] = { 0xfd, MIDI_MUX_CREDIT(MIDI_MUX_CREDIT_MAX_UNITS, c) };
+  const uint8_t running[] = { 0x90, 60, 0xfd, MIDI_MUX_CREDIT(1, c), 100 };
+  const uint8_t reset[] = { 0xfd, MIDI_MUX_CREDIT_RESET(c) };
+  const uint8_t resetRunning[] = { 0x90, 60, 0xfd, MIDI_MUX_CREDIT_RESET(c), 100 };
+  uint8_t note[4] = { 0x09, 0x90, 60, 100 }, program[4] = { 0x0c, 0xc0, 5, 0 }, other[4] = { 0x09, 0x90, 60, 100 };
+  uint8_t e[4];
+  int i;
+
+  note[0] |= c << 4;
+  program[0] |= c << 4;
+  midiMuxInit();
+  if (!midiCreditTake(note) || !midiCreditTake(note))
+    fail("credit", 0, "held before a grant");
+  if (feed(grant, sizeof(grant), e))
+    fail("credit", 0, "grant made an event");
+  if (!midiCreditTake(note) || midiCreditTake(note))
+    fail("credit", 1, "note beyond the credit");
+  feed(grant, sizeof(grant), e);
+  if (!midiCreditTake(program) || !midiCreditTake(program) || midiCreditTake(program))
+    fail("credit", 2, "program change beyond the credit");
+  if ((MIDI_OUT_CABLES > 1) && !midiCreditTake(other))
+    fail("credit", 3, "other cable held");
+  for (i = 0; i < 10; i++)
+    feed(most, sizeof(most), e);
+  for (i = 0; midiCreditTake(note); i++)
+    ;
+  if (i != 0xff / 3)
+    fail("credit", i, "saturated credit");
+  /* the grant is a whole escape, so the data byte after it completes the note */
+  if ((feed(running, sizeof(running), e) != 1) || (e[1] != 0x90) || (e[2] != 60) || (e[3] != 100))
+    fail("credit", 4, "grant in a message");
+  if (!midiCreditTake(note) || midiCreditTake(note))
+    fail("credit", 5, "grant in a message");
+  /* a credit reset drops what is left, the cable staying flow controlled until the next grant */
+  feed(most, sizeof(most), e);
+  if (feed(reset, sizeof(reset), e))
+    fail("credit", 6, "reset made an event");
+  if (midiCreditTake(note))
+    fail("credit", 6, "credit kept after a reset");
+  feed(grant, sizeof(grant), e);
+  if (!midiCreditTake(note) || midiCreditTake(note))
+    fail("credit", 7, "grant after a reset");
+  if ((MIDI_OUT_CABLES > 1) && !midiCreditTake(other))
+    fail("credit", 7, "other cable held after a reset");
+  /* the Main MCU starting up, the reset arriving in a message */
+  midiMuxInit();
+  if ((feed(resetRunning, sizeof(resetRunning), e) != 1) || (e[1] != 0x90) || (e[2] != 60) || (e[3] != 100))
+    fail("credit", 8, "reset in a message");
+  if (midiCreditTake(note))
+    fail("credit", 8, "not flow controlled after a reset");
+  feed(grant, sizeof(grant), e);
+  if (!midiCreditTake(note) || midiCreditTake(note))
+    fail("credit", 9, "grant after a startup reset");
+  midiMuxInit();
+  if (!midiCreditTake(note) || !midiCreditTake(note))
+    fail("credit", 10, "held after reset");
+  printf("credit: cable %d\n", c);
+}
+
+/* The Main MCU's serial output: notes and a controller on the keyboard cable, a trace dump
+ * SysEx response with a clock in the middle of it, MIDI-In traffic with running status on cable 1
+ * and an escaped 0xfd.
+ */
+static const uint8_t recorded[] = {
+  0x90, 0x3c, 0x64, 0x90, 0x40, 0x50, 0x80, 0x3c, 0x00, 0xb0, 0x07, 0x7f,
+  0xf0, 0x7d, 0x03, 0x01, 0x22, 0x33, 0xf8, 0x44, 0x55, 0x66, 0x77, 0xf7,
+  0xfd, 0x01, 0x90, 0x30, 0x40, 0x31, 0x41, 0x32, 0x00, 0xc0, 0x05, 0xe0, 0x00, 0x40,
+  0xfd, 0xfd, 0xfe, 0xfd, 0x00, 0xf0, 0x7e, 0x7f, 0x06, 0x01, 0xf7, 0xf0, 0xf7,
+  0xd0, 0x20, 0x21, 0xf2, 0x10, 0x20, 0xf6,
+};
+
+static void replay(const char *name, const uint8_t *data, long len) {
+  event_t *first = calloc(len + 1, sizeof(event_t));
+  event_t *second = calloc(len + 1, sizeof(event_t));
+  stream_t s = { 0 };
+  long n, m, i;
+
+  midiMuxInit();
+  n = decode(data, len, first, len + 1);
+  for (i = 0; i < n; i++) {
+    const char *err = checkEvent(first[i].b);
+    if (err)
+      fail(name, i, err);
+  }
+  midiMuxInit();
+  encode(first, n, &s);
+  m = decode(s.data, s.len, second, len + 1);
+  if ((m != n) || memcmp(first, second, n * sizeof(event_t)))
+    fail(name, m, "events differ after the round trip");
+  printf("%s: %ld bytes, %ld events\n", name, len, n);
+  free(s.data);
+  free(first);
+  free(second);
+}
+
+static void replayFile(const char *path) {
+  stream_t s = { 0 };
+  FILE *f = fopen(path, "rb");
+  int c;
+  if (!f) {
+    perror(path);
+    failures++;
+    return;
+  }
+  while ((c = fgetc(f)) != EOF)
+    streamPut(&s, c);
+  fclose(f);
+  replay(path, s.data, s.len);
+  free(s.data);
+}
+
+static void benchmark(long count) {
+  event_t *events = calloc(count, sizeof(event_t));
+  stream_t s = { 0 };
+  uint8_t e[4];
+  uint64_t worst = 0, total;
+  uint32_t *best;
+  double t;
+  long i;
+  int pass;
+
+  midiMuxInit();
+  generate(events, count);
+  t = seconds();
+  encode(events, count, &s);
+  t = seconds() - t;
+  printf("USB to serial: %.1f Mbytes/s (serial side)\n", s.len / t / 1e6);
+
+  midiMuxInit();
+  t = seconds();
+  for (i = 0; i < s.len; i++)
+    parseSerialMidiMessage(s.data[i], e);
+  t = seconds() - t;
+  printf("serial to USB: %.1f Mbytes/s\n", s.len / t / 1e6);
+
+  /* Per byte timing - the fastest of several passes for each byte, so the worst case is the
+   * translator's own and not a preemption (the timer overhead is included).
+   */
+  best = malloc(s.len * sizeof(uint32_t));
+  total = 0;
+  for (pass = 0; pass < 5; pass++) {
+    midiMuxInit();
+    for (i = 0; i < s.len; i++) {
+      uint64_t c = cycles();
+      parseSerialMidiMessage(s.data[i], e);
+      c = cycles() - c;
+      if (!pass || (c < best[i]))
+        best[i] = c;
+      total += c;
+    }
+  }
+  for (i = 0; i < s.len; i++) {
+    if (best[i] > worst)
+      worst = best[i];
+  }
+  total /= 5;
+#if defined(__x86_64__) || defined(__i386__)
+  printf("serial to USB: %.1f cycles/byte mean, %llu worst\n", (double)total / s.len, (unsigned long long)worst);
+#else
+  printf("serial to USB: %.1f ns/byte mean, %llu worst\n", (double)total / s.len, (unsigned long long)worst);
+#endif
+  free(best);
+  free(s.data);
+  free(events);
+}
+
+int main(int argc, char *argv[]) {
+  long count = 200000;
+  int i;
+
+  rng = (uint32_t)time(NULL);
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+      count = atol(argv[++i]);
+    } else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+      rng = strtoul(argv[++i], NULL, 0);
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "usage: %s [-n events] [-s seed] [file ...]\n", argv[0]);
+      return 2;
+    } else {
+      break;
+    }
+  }
+  if ((count < 1) || (count > MAX_EVENTS))
+    count = MAX_EVENTS;
+  if (!rng)
+    rng = 1;
+  printf("seed %u, %d cables to the host, %d from it\n", rng, MIDI_IN_CABLES, MIDI_OUT_CABLES);
+
+  RingBuffer_InitBuffer(&link, linkData, sizeof(linkData));
+  roundTrip(count);
+  telemetry(count);
+  fuzzSerial(count * 4);
+  fuzzUSB(count);
+  routes();
+  held();
+  credits();
+  replay("recorded", recorded, sizeof(recorded));
+  for (; i < argc; i++)
+    replayFile(argv[i]);
+  benchmark(count);
+
+  if (failures) {
+    printf("%u failures\n", failures);
+    return 1;
+  }
+  printf("pass\n");
+  return 0;
+}
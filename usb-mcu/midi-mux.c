@@ -0,0 +1,393 @@
+/*
+     Chi-1p-40 USB-MCU Firmware Project
+     Copyright (C) 2018 Darcy Watkins
+     2018/10/22
+     darcy [at] xstreamworship [dot] com
+     http://xstreamworship.com
+
+     Derived from dualMocoLUFA serial / USB-MIDI project
+*/
+/*
+  Copyright 2018 Darcy Watkins (darcy [at] xstreamworship [dot] com)
+  Copyright 2013 by morecat_lab (http://morecatlab.akiba.coocan.jp/)
+
+  Permission to use, copy, modify, distribute, and sell this 
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in 
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting 
+  documentation, and that the name of the author not be used in 
+  advertising or publicity pertaining to distribution of the 
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Translation between USB MIDI event packets and the serial link to the Main MCU, which multiplexes
+ *  the cables using 0xFD as a MIDI-escape sequence.
+ *    0xFD, 0x00 | (0x0f & port_cable_id) - to change the port MIDI stream.
+ *    0xFD, 0xFD - to insert the 0xFD byte (undefined / unused MIDI status code).
+ *    0xFD, (units << 4) | (0x0f & port_cable_id) - credit for units (1 to 7) of 4 more bytes on a
+ *      cable from the host (serial to USB direction only, see midiCreditTake()).
+ *    0xFD, 0x80 | (0x0f & port_cable_id) - drop the credit of a cable from the host, which stays flow
+ *      controlled until the next grant (serial to USB direction only).
+ *    0xFD, [any other value] - both the 0xFD and the escaped byte are discarded.
+ *  This has no hardware dependencies, so it also builds on the host (see host-test).
+ */
+
+#include <stdbool.h>
+
+#include "midi-mux.h"
+
+/* Cable of the serial stream in each direction (both start at 0). */
+static uint8_t txCable;
+static uint8_t rxCable;
+static bool rxEscape;
+static bool rxHeld;		/* the last byte parsed is held in a partly received event */
+
+/* Parser state of each cable to the host (the event itself is built in the caller's packet). */
+static struct {
+  uint8_t status;		/* running status, 0xf0 in SysEx, 0 for none */
+  uint8_t count;		/* data bytes held */
+  uint8_t data[2];	/* data bytes held until the event is complete */
+} RxCable[MIDI_IN_CABLES];
+
+/** Routing of each cable from the host (set by vendor control request). */
+MIDI_Route_t midiRoutes[MIDI_OUT_CABLES];
+
+/* Bytes each flow controlled cable from the host may still send to the Main MCU. */
+static uint8_t credit[MIDI_OUT_CABLES];
+static uint16_t creditOn;	/* mask of the flow controlled cables */
+
+/* Buffer taking the telemetry cable of the serial link, NULL to drop it. */
+static RingBuff_t *telemetryOut;
+
+/** Telemetry bytes lost because the telemetry buffer was full. */
+uint16_t midiTelemetryLost;
+
+/** Resets the translation state in both directions, the routing to forward everything to the
+ *  Main MCU except active sensing on the internal cable (which it has no use for), and turns the
+ *  flow control off until the Main MCU grants credit.
+ */
+void midiMuxInit(void) {
+  uint8_t cable;
+
+  txCable = 0;
+  rxCable = 0;
+  rxEscape = false;
+  rxHeld = false;
+  creditOn = 0;
+  for (cable = 0 ; cable < MIDI_IN_CABLES ; cable++) {
+    RxCable[cable].status = 0;
+    RxCable[cable].count = 0;
+  }
+  for (cable = 0 ; cable < MIDI_OUT_CABLES ; cable++) {
+    midiRoutes[cable].Drop = cable ? 0 : MIDI_DROP_SENSING;
+    midiRoutes[cable].Route = MIDI_ROUTE_SERIAL;
+    credit[cable] = 0;
+  }
+}
+
+/** Sets the buffer that takes the telemetry cable of the serial link (NULL drops it). */
+void midiMuxTelemetry(RingBuff_t *out) {
+  telemetryOut = out;
+}
+
+/* Passes a byte of the telemetry cable on. */
+static void telemetryByte(uint8_t RxByte) {
+  if (!telemetryOut)
+    return;
+  if (RingBuffer_IsFull(telemetryOut))
+    midiTelemetryLost++;
+  else
+    RingBuffer_Insert(telemetryOut, RxByte);
+}
+
+/** Routes a USB MIDI event packet from the host.
+ *
+ *  \param[in] data  USB MIDI event packet
+ *
+ *  \return MIDI_ROUTE_* flags with the loopback cable, 0 if the event is dropped
+ */
+uint8_t midiRoute(const uint8_t *data) {
+  uint8_t cable = data[0] >> 4;
+  uint8_t cin = data[0] & 0x0f;
+  uint16_t drop;
+
+  if ((cable >= MIDI_OUT_CABLES) || (cin < 2))
+    return 0;			/* unused cable, or reserved code index number */
+  drop = midiRoutes[cable].Drop;
+  if (drop & MIDI_DROP_CIN(cin))
+    return 0;
+  if (cin == 0x0f) {
+    if ((data[1] == 0xfe) && (drop & MIDI_DROP_SENSING))
+      return 0;
+    if ((data[1] == 0xf8) && (drop & MIDI_DROP_CLOCK))
+      return 0;
+  }
+  return midiRoutes[cable].Route;
+}
+
+/** Determines if any cable from the host is looped back to it. */
+bool midiRouteLoops(void) {
+  uint8_t cable;
+
+  for (cable = 0 ; cable < MIDI_OUT_CABLES ; cable++) {
+    if (midiRoutes[cable].Route & MIDI_ROUTE_LOOPBACK)
+      return true;
+  }
+  return false;
+}
+
+/* Bytes an event from the host takes on the serial link, not counting escapes. */
+static uint8_t midiEventBytes(uint8_t cin) {
+  if ((cin == 5) || (cin == 15))
+    return 1;
+  if ((cin == 2) || (cin == 6) || (cin == 12) || (cin == 13))
+    return 2;
+  return (cin > 1) ? 3 : 0;
+}
+
+/** Takes the credit to forward a USB MIDI event packet from the host to the Main MCU.
+ *
+ *  \param[in] data  USB MIDI event packet
+ *
+ *  \return Boolean true if the event may be sent (its cable isn't flow controlled, or had the credit),
+ *          false to hold it until the Main MCU grants more
+ */
+bool midiCreditTake(const uint8_t *data) {
+  uint8_t cable = data[0] >> 4;
+  uint8_t bytes;
+
+  if ((cable >= MIDI_OUT_CABLES) || !(creditOn & (1 << cable)))
+    return true;
+  bytes = midiEventBytes(data[0] & 0x0f);
+  if (credit[cable] < bytes)
+    return false;
+  credit[cable] -= bytes;
+  return true;
+}
+
+/** Translates a USB MIDI event packet from the host to the serial link.  The caller makes sure that
+ *  the buffer has room for MIDI_MUX_MAX_SERIAL bytes.
+ *
+ *  \param[in]     data  USB MIDI event packet
+ *  \param[in,out] out   Buffer of the serial link
+ */
+void parseUSBMidiMessage(const uint8_t *data, RingBuff_t *out) {
+  uint8_t in_cable = (*data) >> 4;
+  uint8_t cin = (*data) & 0x0f;	/* code index number */
+  uint8_t i;
+
+  if (in_cable != txCable) {
+    /* The cable has changed, so issue an escape sequence. */
+    RingBuffer_Insert(out, 0xfd ); /* Escape. */
+    RingBuffer_Insert(out, 0x00 + in_cable ); /* Change cable ID (USB to serial direction). */
+    txCable = in_cable;
+  }
+
+  if (cin > 1) {		/* ignore cin == 0 and cin == 1 */
+    for (i = 1 ; i < 4 ; i++) {
+      if (*(data + i) == 0xfd) {
+        /* This means that hereto undefined MIDI 0xfd is actually in use. */
+        RingBuffer_Insert(out, 0xfd ); /* Escape it. */
+      }
+      RingBuffer_Insert(out, *(data + i) ); /* copy to buffer */
+      if (i == 1) {
+	if ((cin == 5) || /* single byte system common */
+	    (cin == 15))  /* single byte */
+	  break;
+      }
+      if (i == 2) {
+	if ((cin == 2) ||  /* two-byte system common */
+	    (cin == 6) ||  /* system ex end with 2 bytes */
+	    (cin == 12) || /* program change */
+	    (cin == 13))   /* channel pressure */
+	  break;
+      }
+    }
+  }
+}
+
+/* Number of data bytes following a status byte (other than SysEx). */
+static uint8_t midiDataBytes(uint8_t status) {
+  if (((status & 0xe0) == 0xc0) ||	/* program change, channel pressure */
+      (status == 0xf1) ||		/* MTC quarter frame */
+      (status == 0xf3))			/* song select */
+    return 1;
+  if (status >= 0xf4)			/* tune request (undefined ones are dropped) */
+    return 0;
+  return 2;
+}
+
+/* Code index number of a complete message (other than SysEx). */
+static uint8_t midiCodeIndex(uint8_t status) {
+  if (status < 0xf0)
+    return status >> 4;			/* channel message */
+  if (status == 0xf2)
+    return 3;				/* three byte system common */
+  return 2;				/* two byte system common */
+}
+
+/** Translates a byte from the serial link to the host.
+ *
+ *  \param[in]  RxByte  Byte received from the serial link
+ *  \param[out] event   Set to the USB MIDI event packet when one is complete
+ *
+ *  \return Boolean true if an event is complete, false otherwise
+ */
+bool parseSerialMidiMessage(uint8_t RxByte, uint8_t *event) {
+  uint8_t cable = rxCable;
+  uint8_t cin;
+
+  rxHeld = false;
+  if (rxEscape) {		/* Realtime multi-byte escape sequence */
+    rxEscape = false;
+    if ((RxByte & 0xf0) == 0x00) {
+      /* Change cable number (serial to USB direction). */
+      rxCable = RxByte & 0x0f;
+      return false;
+    }
+    if (RxByte < 0x80) {
+      /* Credit grant for a cable from the host. */
+      uint16_t total;
+
+      cable = RxByte & 0x0f;
+      if (cable < MIDI_OUT_CABLES) {
+        total = credit[cable] + (RxByte >> 4) * MIDI_MUX_CREDIT_UNIT;
+        credit[cable] = (total > 0xff) ? 0xff : total;
+        creditOn |= (1 << cable);
+      }
+      return false;
+    }
+    if ((RxByte & 0xf0) == 0x80) {
+      /* Credit reset for a cable from the host (the Main MCU is counting from nothing). */
+      cable = RxByte & 0x0f;
+      if (cable < MIDI_OUT_CABLES) {
+        credit[cable] = 0;
+        creditOn |= (1 << cable);
+      }
+      return false;
+    }
+    if ((cable == MIDI_TELEMETRY_CABLE) && (RxByte == 0xfd)) {
+      telemetryByte(RxByte);
+      return false;
+    }
+    if ((cable < MIDI_IN_CABLES) && (RxByte == 0xfd)) {
+      /* This means that hereto undefined MIDI 0xfd is actually in use. */
+      /* Treat as single byte realtime MIDI message. */
+      event[0] = 0x0f + (cable << 4);
+      event[1] = RxByte;
+      event[2] = 0;
+      event[3] = 0;
+      return true;
+    }
+    /* Otherwise unsupported cable ID, or unsupported escape sequence, ignore it. */
+    /* Note: Backwards compatibility is not assured if the escape sequence exceeds one byte. */
+    return false;
+  }
+  if (RxByte == 0xfd){		/* Realtime multi-byte escape sequence */
+    rxEscape = true;
+    return false;
+  }
+  if (cable >= MIDI_IN_CABLES) {
+    /* Telemetry, or unsupported cable ID - ignore all until escape sequence puts us back on track. */
+    if (cable == MIDI_TELEMETRY_CABLE)
+      telemetryByte(RxByte);
+    return false;
+  }
+  if (RxByte >= 0xf8){	/* Single Byte Message (may be anywhere, even in SysEx) */
+    event[0] = 0x0f + (cable << 4);
+    event[1] = RxByte;
+    event[2] = 0;
+    event[3] = 0;
+    return true;
+  }
+
+  if (RxCable[cable].status == 0xf0){  		/* MIDI System Exclusive */
+    if (RxByte < 0x80){
+      if (RxCable[cable].count < 2) {
+        RxCable[cable].data[RxCable[cable].count++] = RxByte;
+        rxHeld = true;
+        return false;
+      }
+      event[0] = 0x04 + (cable << 4);	/* sysEx start or continue */
+      event[1] = RxCable[cable].data[0];
+      event[2] = RxCable[cable].data[1];
+      event[3] = RxByte;
+      RxCable[cable].count = 0;
+      return true;		/* send sysEx */
+    }
+    RxCable[cable].status = 0;
+    if (RxByte == 0xf7){		/* MIDI_EndSysEx */
+      /* 0x05 (single byte), 0x06 (two bytes), or 0x07 (three bytes) */
+      event[0] = (RxCable[cable].count + 5) + (cable << 4);
+      event[1] = RxCable[cable].count ? RxCable[cable].data[0] : RxByte;
+      event[2] = (RxCable[cable].count == 2) ? RxCable[cable].data[1] : (RxCable[cable].count ? RxByte : 0);
+      event[3] = (RxCable[cable].count == 2) ? RxByte : 0;
+      RxCable[cable].count = 0;
+      return true;		/* send sysEx */
+    }
+    /* Any other status byte cuts the SysEx short, start the new message. */
+  }
+
+  if (RxByte >= 0x80){		/* Status byte */
+    RxCable[cable].count = 0;
+    if (RxByte == 0xf0){		/* MIDI_StartSysEx */
+      RxCable[cable].status = RxByte;
+      RxCable[cable].data[0] = RxByte;
+      RxCable[cable].count = 1;
+      rxHeld = true;
+      return false;
+    }
+    if (midiDataBytes(RxByte) == 0) {
+      RxCable[cable].status = 0;
+      if (RxByte != 0xf6)
+        return false;		/* undefined or stray end of SysEx */
+      event[0] = 0x05 + (cable << 4);	/* tune request */
+      event[1] = RxByte;
+      event[2] = 0;
+      event[3] = 0;
+      return true;
+    }
+    RxCable[cable].status = RxByte;
+    rxHeld = true;
+    return false;
+  }
+
+  /* Data byte, for the running status. */
+  if (RxCable[cable].status == 0)
+    return false;
+  if (midiDataBytes(RxCable[cable].status) > RxCable[cable].count + 1) {
+    RxCable[cable].data[RxCable[cable].count++] = RxByte;
+    rxHeld = true;
+    return false;
+  }
+  cin = midiCodeIndex(RxCable[cable].status);
+  event[0] = cin + (cable << 4);
+  event[1] = RxCable[cable].status;
+  event[2] = RxCable[cable].count ? RxCable[cable].data[0] : RxByte;
+  event[3] = RxCable[cable].count ? RxByte : 0;
+  RxCable[cable].count = 0;
+  if (RxCable[cable].status >= 0xf0)
+    RxCable[cable].status = 0;	/* system common has no running status */
+  return true;
+}
+
+/** Determines if the last byte given to parseSerialMidiMessage() is held in a partly received
+ *  event for the host.  A byte that neither completed an event nor is held (telemetry, an escape,
+ *  a stray data byte) takes no part in any event to the host.
+ */
+bool midiMuxHeld(void) {
+  return rxHeld;
+}
+
@@ -0,0 +1,118 @@
+/*
+     Chi-1p-40 USB-MCU Firmware Project
+     Copyright (C) 2018 Darcy Watkins
+     2018/10/22
+     darcy [at] xstreamworship [dot] com
+     http://xstreamworship.com
+
+     Derived from dualMocoLUFA serial / USB-MIDI project
+*/
+/*
+  Copyright 2018 Darcy Watkins (darcy [at] xstreamworship [dot] com)
+  Copyright 2013 by morecat_lab (http://morecatlab.akiba.coocan.jp/)
+
+  Permission to use, copy, modify, distribute, and sell this 
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in 
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting 
+  documentation, and that the name of the author not be used in 
+  advertising or publicity pertaining to distribution of the 
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for midi-mux.c
+ */
+
+#ifndef _MIDI_MUX_H_
+#define _MIDI_MUX_H_
+
+	/* Includes: */
+		#include <stdint.h>
+		#include <stdbool.h>
+
+		#include "Lib/LightweightRingBuff.h"
+
+	/* Macros: */
+		/** Number of virtual cables from the host (embedded MIDI IN jacks on the OUT endpoint), 1 to 16.
+		 *  Must be a plain number, it selects the MIDI_REPEAT_n macro that generates the jacks.
+		 */
+		#ifndef MIDI_OUT_CABLES
+			#define MIDI_OUT_CABLES         3
+		#endif
+		/** Number of virtual cables to the host (embedded MIDI OUT jacks on the IN endpoint), 1 to 15.
+		 *  Must be a plain number, as for MIDI_OUT_CABLES.
+		 */
+		#ifndef MIDI_IN_CABLES
+			#define MIDI_IN_CABLES          2
+		#endif
+
+		/** Cable of the serial link that carries telemetry from the Main MCU rather than MIDI - raw bytes
+		 *  (with 0xFD escaped as for MIDI), passed to the telemetry buffer (see midiMuxTelemetry()).
+		 */
+		#define MIDI_TELEMETRY_CABLE    15
+
+		/** Escape of a credit grant from the Main MCU - 0xFD, MIDI_MUX_CREDIT(Units, Cable), for Units (1 to
+		 *  MIDI_MUX_CREDIT_MAX_UNITS) of MIDI_MUX_CREDIT_UNIT bytes.  Two bytes like the other escapes, so
+		 *  firmware that doesn't know it drops it whole.  Once granted credit, a cable from the host is
+		 *  flow controlled (see midiCreditTake()).
+		 */
+		#define MIDI_MUX_CREDIT(Units, Cable) (((Units) << 4) | (Cable))
+		#define MIDI_MUX_CREDIT_UNIT          4
+		#define MIDI_MUX_CREDIT_MAX_UNITS     7
+
+		/** Escape of a credit reset from the Main MCU - 0xFD, MIDI_MUX_CREDIT_RESET(Cable).  Drops the credit
+		 *  the cable has left, which stays flow controlled until the next grant.  The Main MCU sends it when
+		 *  it starts counting its grants afresh (after it resets, or to resynchronise after this MCU did).
+		 */
+		#define MIDI_MUX_CREDIT_RESET(Cable)  (0x80 | (Cable))
+
+		/** Most bytes one USB MIDI event takes on the serial link (cable change and three escaped bytes). */
+		#define MIDI_MUX_MAX_SERIAL     8
+
+		/** Route flags of a cable from the host (\ref MIDI_Route_t). */
+		#define MIDI_ROUTE_SERIAL            0x01 /**< Forward to the Main MCU over the serial link. */
+		#define MIDI_ROUTE_LOOPBACK          0x02 /**< Loop back to the host, on the cable in the top nibble. */
+		#define MIDI_ROUTE_LOOP_CABLE(Cable) ((Cable) << 4)
+
+		/** Drop mask bits (\ref MIDI_Route_t) - one per code index number 2 to 15, and as the code
+		 *  index numbers 0 and 1 are never forwarded, their bits select single realtime messages.
+		 */
+		#define MIDI_DROP_CIN(Cin)           (1 << (Cin))
+		#define MIDI_DROP_SENSING            (1 << 0) /**< Active sensing (0xfe). */
+		#define MIDI_DROP_CLOCK              (1 << 1) /**< Timing clock (0xf8). */
+
+	/* Type Defines: */
+		/** Routing and filtering of one cable from the host. */
+		typedef struct
+		{
+			uint16_t Drop; /**< Events dropped, a mask of MIDI_DROP_* bits. */
+			uint8_t  Route; /**< Where the other events go, MIDI_ROUTE_* flags. */
+		} MIDI_Route_t;
+
+	/* Shared variables: */
+		extern MIDI_Route_t midiRoutes[MIDI_OUT_CABLES];
+		extern uint16_t midiTelemetryLost;
+
+	/* Function Prototypes: */
+		void midiMuxInit(void);
+		void midiMuxTelemetry(RingBuff_t *out);
+		uint8_t midiRoute(const uint8_t *data);
+		bool midiRouteLoops(void);
+		bool midiCreditTake(const uint8_t *data);
+		bool parseSerialMidiMessage(uint8_t RxByte, uint8_t *event);
+		bool midiMuxHeld(void);
+		void parseUSBMidiMessage(const uint8_t *data, RingBuff_t *out);
+
+#endif /* _MIDI_MUX_H_ */
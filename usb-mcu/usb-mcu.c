@@ -12,9 +12,15 @@
      Serial USB-MIDI multiplexed using 0xFD as a MIDI-escape sequence.
      0xFD, 0x00 | (0x0f & port_cable_id) - to change the port MIDI stream.
      0xFD, 0xFD - to insert the 0xFD byte (undefined / unused MIDI status code).
+     0xFD, (units << 4) | (0x0f & port_cable_id) - credit of units * 4 bytes for a cable from the host (from the main MCU).
+     0xFD, 0x80 | (0x0f & port_cable_id) - drop the credit of a cable from the host (from the main MCU).
      0xFD, [any other value] - both the 0xFD and the escaped byte are discarded.
 
-     MIDI router (details to be added).
+     MIDI router - each cable from the host can drop message types, be forwarded to the main MCU,
+     and / or be looped back to a cable to the host (see REQ_SetMidiRoute).
+
+     Telemetry - cable 15 of the serial link carries raw telemetry from the Main MCU to a vendor
+     specific bulk IN endpoint, alongside the MIDI interface.
 
      Derived from dualMocoLUFA serial / USB-MIDI project
      Derived from USB-MIDI interface LUFA Library project template.
@@ -73,11 +79,45 @@ uchar systemMode = 1;	/* 0: Serial , 1: MIDI */
 uchar highSpeed = 0;		/* 0: normal speed(31250bps),
 				   1: high speed (1250000bps) */
 
+#if (USB_TO_USART_BUFFER_SIZE & (USB_TO_USART_BUFFER_SIZE - 1)) || (USB_TO_USART_BUFFER_SIZE > 256)
+#error USB_TO_USART_BUFFER_SIZE must be a power of two, up to 256
+#endif
+#if (USART_TO_USB_BUFFER_SIZE & (USART_TO_USB_BUFFER_SIZE - 1)) || (USART_TO_USB_BUFFER_SIZE > 256)
+#error USART_TO_USB_BUFFER_SIZE must be a power of two, up to 256
+#endif
+
 /** Circular buffer to hold data from the host before it is sent to the device via the serial port. */
 RingBuff_t USBtoUSART_Buffer;
+static RingBuff_Data_t USBtoUSART_Data[USB_TO_USART_BUFFER_SIZE];
 
 /** Circular buffer to hold data from the serial port before it is sent to the host. */
 RingBuff_t USARTtoUSB_Buffer;
+static RingBuff_Data_t USARTtoUSB_Data[USART_TO_USB_BUFFER_SIZE];
+
+/** Circular buffer to hold telemetry from the Main MCU before it is sent to the host. */
+RingBuff_t Telemetry_Buffer;
+static RingBuff_Data_t Telemetry_Data[TELEMETRY_BUFFER_SIZE];
+
+/** Health counters (MIDI mode), the telemetry loss count is taken from midi-mux when they are read. */
+static USB_MCU_Stats_t Stats;
+
+/** Latency of the events to the host (MIDI mode). */
+static USB_MCU_Latency_t Latency;
+static uchar FrameEvents;	/* events to the host since the last start of frame */
+
+/* The byte being timed for Latency, from the serial ISR arming it to its event's bank being sent. */
+#define PROBE_IDLE      0
+#define PROBE_ARMED     1	/* in USARTtoUSB_Buffer at Index */
+#define PROBE_CONSUMED  2	/* parsed, its event not yet complete */
+#define PROBE_QUEUED    3	/* its event is in the MIDI IN bank */
+static volatile struct {
+  uchar State;
+  RingBuff_Count_t Index;
+  LatencyTime_t Start;
+} Probe;
+
+/* Timer 0 at the last start of frame. */
+static volatile uchar sofTicks;
 
 /** Pulse generation counters to keep track of the number of milliseconds remaining for each pulse type */
 volatile struct {
@@ -86,18 +126,8 @@ volatile struct {
   uint8_t PingPongLEDPulse; /**< Milliseconds remaining for enumeration Tx/Rx ping-pong LED pulse */
 } PulseMSRemaining;
 
-#define    RX_SIZE        (HW_CDC_BULK_IN_SIZE)
-static uchar utxrdy = FALSE;	/* USB Packet ready in utx_buf */
-static uchar utx_buf[RX_SIZE];	/* BULK_IN buffer */
-
-/* Even though 16 cables are possible, we only support 2. */
-#define    RX_CABLE_DESCS 2
-static struct {
-  uchar PC;
-  uchar SysEx;
-  uchar sysExCnt;
-  uchar rx_buf[RX_SIZE];	/* tempory buffer */
-} RxCableDesc[RX_CABLE_DESCS] = { 0 };
+/* Set at each start of frame, a partly filled MIDI (or CDC) IN bank is sent then. */
+static volatile uchar sofFlush = FALSE;
 
 /** LUFA CDC Class driver interface configuration and state information. This structure is
  *  passed to all CDC Class driver functions, so that multiple instances of the same class
@@ -127,156 +157,133 @@ USB_ClassInfo_MIDI_Device_t Keyboard_MIDI_Interface =  {
     .StreamingInterfaceNumber = 1,
     
     .DataINEndpointNumber      = MIDI_STREAM_IN_EPNUM,
-    .DataINEndpointSize        = MIDI_STREAM_EPSIZE,
-    .DataINEndpointDoubleBank  = false,
+    .DataINEndpointSize        = MIDI_STREAM_IN_EPSIZE,
+    .DataINEndpointDoubleBank  = true,
     
     .DataOUTEndpointNumber     = MIDI_STREAM_OUT_EPNUM,
-    .DataOUTEndpointSize       = MIDI_STREAM_EPSIZE,
+    .DataOUTEndpointSize       = MIDI_STREAM_OUT_EPSIZE,
     .DataOUTEndpointDoubleBank = false,
   },
 };
 
-void parseUSBMidiMessage(uchar *data) {
-  static uchar cable = 0;
-  uchar in_cable = (*data) >> 4;
-  uchar cin = (*data) & 0x0f;	/* code index number */
-  uchar i;
+/* Gets the current time, with interrupts disabled (a pending start of frame has already moved the
+ * frame number on, but not sofTicks).
+ */
+static inline void latencyNow(LatencyTime_t *Time) {
+  Time->Frame = UDFNUM;
+  Time->Ticks = (UDINT & (1 << SOFI)) ? 0 : (uchar)(TCNT0 - sofTicks);
+}
 
-  if (in_cable != cable) {
-    /* The cable has changed, so issue an escape sequence. */
-    RingBuffer_Insert(&USBtoUSART_Buffer, 0xfd ); /* Escape. */
-    RingBuffer_Insert(&USBtoUSART_Buffer, 0x00 + in_cable ); /* Change cable ID (USB to serial direction). */
-    cable = in_cable;
-  }
+/* Microseconds since the probe's arrival (saturated). */
+static uint16_t latencySince(void) {
+  LatencyTime_t Now;
+  uint16_t Frames;
+  int32_t Delay;
 
-  if (cin > 1) {		/* ignore cin == 0 and cin == 1 */
-    for (i = 1 ; i < 4 ; i++) {
-      if (*(data + i) == 0xfd) {
-        /* This means that hereto undefined MIDI 0xfd is actually in use. */
-        RingBuffer_Insert(&USBtoUSART_Buffer, 0xfd ); /* Escape it. */
-      }
-      RingBuffer_Insert(&USBtoUSART_Buffer, *(data + i) ); /* copy to buffer */
-      if (i == 1) {
-	if ((cin == 5) || /* single byte system common */
-	    (cin == 15))  /* single byte */
-	  break;
-      }
-      if (i == 2) {
-	if ((cin == 2) ||  /* two-byte system common */
-	    (cin == 6) ||  /* system ex end with 2 bytes */
-	    (cin == 12) || /* program change */
-	    (cin == 13))   /* channel pressure */
-	  break;
-      }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      latencyNow(&Now);
     }
-  }
+  /* the frame number wraps every 2048 frames, so anything older is past telling */
+  Frames = (Now.Frame - Probe.Start.Frame) & 0x7ff;
+  if (Frames > 65)
+    return 0xffff;
+  Delay = ((int32_t)Frames * 1000) + ((int16_t)Now.Ticks - Probe.Start.Ticks) * 16;
+  if (Delay < 0)
+    return 0;
+  return (Delay > 0xffff) ? 0xffff : Delay;
 }
 
-uchar parseSerialMidiMessage(uchar RxByte) {
-  static uchar cable = 0;
-  static uchar EscapeSeq = FALSE;
-  static uchar stateTransTable[] = {
-    0, 				/* 0 dummy */
-    0,				/* 1 dummy */
-    3,				/* 2->3 NOTE OFF (3) */
-    2 | 0x80,			/* 3->2 */
-    5,				/* 4->5 NOTE ON (3) */
-    4 | 0x80,			/* 5->4 */
-    7,				/* 6->7 Polyphonic key pressure (3) */
-    6 | 0x80,			/* 7->6 */
-    9,				/* 8->9 Control Change (3) */
-    8 | 0x80,			/* 8->9 */
-    10 | 0x80,			/* 10->10 program change (2) */
-    0,				/* dummy */
-    12 | 0x80,			/* 12->12 Channel Pressure (2) */
-    0,				/* 13 dummy */
-    15,				/* 14->15 Pitch Bend (3) */
-    14 | 0x80			/* 15->14 */
-  };
-  if (EscapeSeq) {		/* Realtime multi-byte escape sequence */
-    if ((RxByte & 0xf0) == 0x00) {
-      /* Change cable number (serial to USB direction). */
-      cable = RxByte & 0x0f;
-      EscapeSeq = FALSE;
-      return FALSE;
-    }
-    if ((cable < RX_CABLE_DESCS) && (RxByte == 0xfd)) {
-      /* This means that hereto undefined MIDI 0xfd is actually in use. */
-      /* Treat as single byte realtime MIDI message. */
-      utx_buf[0] = 0x0f + (cable << 4);
-      utx_buf[1] = RxByte;
-      utx_buf[2] = 0;
-      utx_buf[3] = 0;
-      EscapeSeq = FALSE;
-      return TRUE;
+/* The probe's event has gone into the MIDI IN bank. */
+static void latencyQueued(void) {
+  uint16_t Delay = latencySince();
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      if (Delay > Latency.QueueMax)
+	Latency.QueueMax = Delay;
     }
-    /* Otherwise unsupported cable ID, or unsupported escape sequence, ignore it. */
-    /* Note: Backwards compatibility is not assured if the escape sequence exceeds one byte. */
-    EscapeSeq = FALSE;
-    return FALSE;
-  }
-  if (RxByte == 0xfd){		/* Realtime multi-byte escape sequence */
-    EscapeSeq = TRUE;
-    return FALSE;
-  }
-  if (cable >= RX_CABLE_DESCS) {
-    /* Unsupported cable ID, ignore all until escape sequence puts us back on track. */
-    return FALSE;
-  }
-  if (RxCableDesc[cable].SysEx){  		/* MIDI System Message */
-    if (RxByte == 0xf7){		/* MIDI_EndSysEx */
-      RxCableDesc[cable].rx_buf[RxCableDesc[cable].sysExCnt++] = RxByte;
-      RxCableDesc[cable].rx_buf[0] = ((RxCableDesc[cable].sysExCnt + 3) & 0x0f) + (cable << 4); /* 0x05(single byte), 0x06(two bytes), or 0x07(three bytes) */
-      memcpy(utx_buf, RxCableDesc[cable].rx_buf, 4);
-      RxCableDesc[cable].SysEx = FALSE;
-      RxCableDesc[cable].PC = 0;
-      return TRUE;		/* send sysEx */
-    } else {
-      RxCableDesc[cable].rx_buf[RxCableDesc[cable].sysExCnt++] = RxByte;
-      if (RxCableDesc[cable].sysExCnt == 4) {	/* buffer full */
-	RxCableDesc[cable].rx_buf[0] = 0x04 + (cable << 4);	/* sysEx start */
-        memcpy(utx_buf, RxCableDesc[cable].rx_buf, 4);
-	RxCableDesc[cable].sysExCnt = 1;
-	return TRUE;		/* send sysEx */
+  Probe.State = PROBE_QUEUED;
+}
+
+/* The MIDI IN bank is being sent, with the probe's event if it is there. */
+static void latencySent(void) {
+  uint16_t Delay;
+  uchar Bin = 0;
+  uchar i;
+
+  if (Probe.State != PROBE_QUEUED)
+    return;
+  Delay = latencySince();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      if (Delay > Latency.SendMax)
+	Latency.SendMax = Delay;
+      for (Delay >>= LATENCY_BIN0_SHIFT; Delay && (Bin < (LATENCY_BINS - 1)); Delay >>= 1)
+	Bin++;
+      if (Latency.Samples == 0xffff) {
+	/* Halve rather than wrap so the histogram keeps its shape. */
+	Latency.Samples >>= 1;
+	for (i = 0; i < LATENCY_BINS; i++)
+	  Latency.Bins[i] >>= 1;
       }
+      Latency.Samples++;
+      Latency.Bins[Bin]++;
     }
-    return FALSE;
-  }
-  if (RxByte >= 0xf8){	/* Single Byte Message */
-    utx_buf[0] = 0x0f + (cable << 4);
-    utx_buf[1] = RxByte;
-    utx_buf[2] = 0;
-    utx_buf[3] = 0;
-    return TRUE;
-  }
-  if(RxByte > 0x7f){		/* Channel message */
-    if(RxByte == 0xf0){		/* MIDI_StartSysEx */
-      RxCableDesc[cable].SysEx = TRUE;
-      RxCableDesc[cable].rx_buf[1] = 0xf0;
-      RxCableDesc[cable].sysExCnt = 2;		/* start utx_buf[2]  */
-      return FALSE;
+  Probe.State = PROBE_IDLE;
+}
+
+/* Counts the events to the host in the frame just ended. */
+static void latencyFrame(void) {
+  if (!FrameEvents)
+    return;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      if ((Latency.Frames == 0xffff) || (Latency.Events > (uint16_t)(0xffff - FrameEvents))) {
+	Latency.Frames >>= 1;
+	Latency.Events >>= 1;
+      }
+      Latency.Frames++;
+      Latency.Events += FrameEvents;
+      if (FrameEvents > Latency.FrameEventsMax)
+	Latency.FrameEventsMax = FrameEvents;
     }
-    RxCableDesc[cable].PC = 0;
+  FrameEvents = 0;
+}
+
+/* Writes an event to the selected MIDI IN endpoint bank (which must have room for it). */
+static inline void writeHostEvent(const MIDI_EventPacket_t *Event) {
+  Endpoint_Write_Stream_LE(Event, sizeof(MIDI_EventPacket_t), NO_STREAM_CALLBACK);
+  FrameEvents++;
+  if (!Endpoint_IsReadWriteAllowed()) {
+    /* Bank full - send it (the other bank takes the next events). */
+    Endpoint_ClearIN();
+    latencySent();
   }
+}
 
-  if (RxCableDesc[cable].PC == 0) {
-    RxCableDesc[cable].PC = (((RxByte >> 4) & 0x07) + 1) * 2;
-    // conversion
-    // 0x80 -> 2, 0x90 -> 4, 0xa0 -> 6, 0xb0 -> 8, 0xc0 -> 10, 0xd0 -> 12, 0xe0 -> 14
-    RxCableDesc[cable].rx_buf[0] = RxByte >> 4;
-    RxCableDesc[cable].rx_buf[1] = RxByte;
-    RxCableDesc[cable].rx_buf[3] = 0;
-  } else {
-    uchar tt = stateTransTable[RxCableDesc[cable].PC];
-    RxCableDesc[cable].rx_buf[(RxCableDesc[cable].PC & 1) + 2] = RxByte;
-    RxCableDesc[cable].PC = tt & 0x0f;
-    if ((tt & 0x80) != 0) {
-      memcpy(utx_buf, RxCableDesc[cable].rx_buf, 4);
-      utx_buf[0] = (utx_buf[0] & 0x0f) + (cable << 4);
-      return TRUE;
-    }
+/* Moves telemetry into its IN endpoint bank, sending the bank once it is full. */
+static void sendTelemetry(void) {
+  RingBuff_Data_t *Data;
+  RingBuff_Count_t Count = RingBuffer_Peek(&Telemetry_Buffer, &Data);
+  RingBuff_Count_t Used = 0;
+
+  Endpoint_SelectEndpoint(TELEMETRY_IN_EPNUM);
+  while ((Used < Count) && Endpoint_IsReadWriteAllowed()) {
+    Endpoint_Write_Byte(Data[Used++]);
+    if (!Endpoint_IsReadWriteAllowed())
+      Endpoint_ClearIN();
   }
-  return FALSE;
+  if (Used)
+    RingBuffer_Commit(&Telemetry_Buffer, Used);
+}
+
+/* Determines if the MIDI IN endpoint bank has room for an event. */
+static inline bool hostEventRoom(void) {
+  if (USB_DeviceState != DEVICE_STATE_Configured)
+    return false;
+  Endpoint_SelectEndpoint(MIDI_STREAM_IN_EPNUM);
+  return Endpoint_IsReadWriteAllowed();
 }
 
 /** Main program entry point. This routine contains the overall program flow, including initial
@@ -297,43 +304,113 @@ void processMIDI() {
 #define CNTMAX 40
   static uint8_t cnt = CNTMAX;
 
-  RingBuffer_InitBuffer(&USBtoUSART_Buffer);
-  RingBuffer_InitBuffer(&USARTtoUSB_Buffer);
+  RingBuffer_InitBuffer(&USBtoUSART_Buffer, USBtoUSART_Data, sizeof(USBtoUSART_Data));
+  RingBuffer_InitBuffer(&USARTtoUSB_Buffer, USARTtoUSB_Data, sizeof(USARTtoUSB_Data));
+  RingBuffer_InitBuffer(&Telemetry_Buffer, Telemetry_Data, sizeof(Telemetry_Data));
+  midiMuxInit();
+  midiMuxTelemetry(&Telemetry_Buffer);
 
   sei();
 
+  uint8_t LoopStart = TCNT0;
   for (;;){
-    /* receive from Serial MIDI line */
-    while ( !utxrdy && !RingBuffer_IsEmpty(&USARTtoUSB_Buffer) ) {
-      utxrdy |= parseSerialMidiMessage(RingBuffer_Remove(&USARTtoUSB_Buffer));
-      LEDs_TurnOnLEDs(LEDMASK_TX);
-      PulseMSRemaining.TxLEDPulse = TX_RX_LED_PULSE_MS;
-    }
+    uint8_t LoopTicks = TCNT0 - LoopStart;
+    LoopStart += LoopTicks;
+    if (LoopTicks > Stats.LoopMax)
+      Stats.LoopMax = LoopTicks;
+
+    /* receive from Serial MIDI line, packing the events into the USB MIDI IN bank */
+    if (USB_DeviceState == DEVICE_STATE_Configured) {
+      RingBuff_Data_t *RxData;
+      RingBuff_Count_t RxCount = RingBuffer_Peek(&USARTtoUSB_Buffer, &RxData);
+      RingBuff_Count_t RxUsed = 0;
+      MIDI_EventPacket_t SentMIDIEvent;
+      /* bytes to parse before the probe's event can complete (never, if there is none) */
+      uint16_t ProbeAt = (Probe.State == PROBE_ARMED) ? ((Probe.Index - USARTtoUSB_Buffer.Out) & USARTtoUSB_Buffer.Mask) :
+        (Probe.State == PROBE_CONSUMED) ? 0 : 0xffff;
+
+      if (RingBuffer_GetCount(&USARTtoUSB_Buffer) > Stats.USARTtoUSBHigh)
+        Stats.USARTtoUSBHigh = RingBuffer_GetCount(&USARTtoUSB_Buffer);
+
+      Endpoint_SelectEndpoint(MIDI_STREAM_IN_EPNUM);
+      while ( (RxUsed < RxCount) && Endpoint_IsReadWriteAllowed() ) {
+        if (parseSerialMidiMessage(RxData[RxUsed++], (uchar *)&SentMIDIEvent)) {
+          if (RxUsed > ProbeAt) {
+            latencyQueued();
+            ProbeAt = 0xffff;
+          }
+          writeHostEvent(&SentMIDIEvent);
+        } else if ((RxUsed == ProbeAt + 1) && !midiMuxHeld() && (Probe.State == PROBE_ARMED)) {
+          /* the probe's byte is no part of an event to the host (telemetry, an escape, a stray byte) */
+          Probe.State = PROBE_IDLE;
+          ProbeAt = 0xffff;
+        }
+      }
+      if (RxUsed > ProbeAt)
+        Probe.State = PROBE_CONSUMED;
+      if (RxUsed) {
+        RingBuffer_Commit(&USARTtoUSB_Buffer, RxUsed);
+        LEDs_TurnOnLEDs(LEDMASK_TX);
+        PulseMSRemaining.TxLEDPulse = TX_RX_LED_PULSE_MS;
+      }
+
+      /* send a partly filled bank once per frame */
+      if (sofFlush) {
+        if (Endpoint_IsReadWriteAllowed() && Endpoint_BytesInEndpoint()) {
+          Endpoint_ClearIN();
+          latencySent();
+        }
+        latencyFrame();
+      }
 
-    /* send packets to USB MIDI */
-    if ( utxrdy ) {
-      MIDI_Device_SendEventPacket(&Keyboard_MIDI_Interface, (MIDI_EventPacket_t *)&utx_buf);
-      MIDI_Device_Flush(&Keyboard_MIDI_Interface);
-      utxrdy = FALSE;
+      /* telemetry from the Main MCU, likewise */
+      sendTelemetry();
+      if (sofFlush) {
+        sofFlush = FALSE;
+        if (Endpoint_IsReadWriteAllowed() && Endpoint_BytesInEndpoint())
+          Endpoint_ClearIN();
+      }
     }
 
     /* receive from USB MIDI */
 // Buffer reserve is large enough to ensure that parseUSBMidiMessage() doesn't run out
 // of space while translating a USB MIDI message to the multiplexed serial MIDI.
-#define BUFFER_RESERVE 8
-    MIDI_EventPacket_t ReceivedMIDIEvent;
-    while ((RingBuffer_GetCount(&USBtoUSART_Buffer) < (BUFFER_SIZE - BUFFER_RESERVE)) &&
-      MIDI_Device_ReceiveEventPacket(&Keyboard_MIDI_Interface, &ReceivedMIDIEvent)) {
-      /* for each MIDI packet w/ 4 bytes */
-      parseUSBMidiMessage((uchar *)&ReceivedMIDIEvent);
+#define BUFFER_RESERVE MIDI_MUX_MAX_SERIAL
+    /* an event held for credit stops reading the OUT endpoint, so the host is NAKed until the
+       Main MCU grants more (see midiCreditTake()).  The events behind it on the other cables wait
+       too - USB MIDI carries every cable on the one endpoint, and holding per cable would mean
+       buffering whatever the host sends behind the held event (up to a whole SysEx dump) in the
+       few hundred bytes of SRAM left.  It only stalls once the host is further ahead of a 31250
+       baud jack than the jack's transmit buffer, where the alternative is losing its data. */
+    static MIDI_EventPacket_t ReceivedMIDIEvent;
+    static bool HeldMIDIEvent = false;
+    bool Loops = midiRouteLoops();
+    while ((RingBuffer_GetFree(&USBtoUSART_Buffer) >= BUFFER_RESERVE) &&
+      (!Loops || hostEventRoom()) &&
+      (HeldMIDIEvent || MIDI_Device_ReceiveEventPacket(&Keyboard_MIDI_Interface, &ReceivedMIDIEvent))) {
+      /* for each MIDI packet w/ 4 bytes, as routed */
+      uchar route = midiRoute((uchar *)&ReceivedMIDIEvent);
+      HeldMIDIEvent = (route & MIDI_ROUTE_SERIAL) && !midiCreditTake((uchar *)&ReceivedMIDIEvent);
+      if (HeldMIDIEvent)
+        break;
+      if (route & MIDI_ROUTE_SERIAL) {
+        parseUSBMidiMessage((uchar *)&ReceivedMIDIEvent, &USBtoUSART_Buffer);
+      }
+      if (route & MIDI_ROUTE_LOOPBACK) {
+        ReceivedMIDIEvent.CableNumber = route >> 4;
+        Endpoint_SelectEndpoint(MIDI_STREAM_IN_EPNUM);
+        writeHostEvent(&ReceivedMIDIEvent);
+      }
       LEDs_TurnOnLEDs(LEDMASK_RX);
       PulseMSRemaining.RxLEDPulse = TX_RX_LED_PULSE_MS;
     }
 
-    /* send to Serial MIDI line  */
-    if ((UCSR1A & (1<<UDRE1)) &&
-      !(RingBuffer_IsEmpty(&USBtoUSART_Buffer))) {
-      UDR1 = RingBuffer_Remove(&USBtoUSART_Buffer);
+    if (RingBuffer_GetCount(&USBtoUSART_Buffer) > Stats.USBtoUSARTHigh)
+      Stats.USBtoUSARTHigh = RingBuffer_GetCount(&USBtoUSART_Buffer);
+
+    /* send to Serial MIDI line (the UDRE interrupt drains the buffer at line rate) */
+    if (!(RingBuffer_IsEmpty(&USBtoUSART_Buffer))) {
+      UCSR1B |= (1<<UDRIE1);
     }
 
     if (TIFR0 & (1 << TOV0)) {
@@ -362,39 +439,81 @@ void processMIDI() {
 
 
 void processSerial(void) {
-	
-  RingBuffer_InitBuffer(&USBtoUSART_Buffer);
-  RingBuffer_InitBuffer(&USARTtoUSB_Buffer);
+  /* Set when the last IN packet was a full bank, so the transfer is ended by a zero length packet. */
+  bool TxBankFull = false;
+
+  RingBuffer_InitBuffer(&USBtoUSART_Buffer, USBtoUSART_Data, sizeof(USBtoUSART_Data));
+  RingBuffer_InitBuffer(&USARTtoUSB_Buffer, USARTtoUSB_Data, sizeof(USARTtoUSB_Data));
 
   sei();
 
   for (;;)
     {
-      /* Only try to read in bytes from the CDC interface if the transmit buffer is not full */
-      if (!(RingBuffer_IsFull(&USBtoUSART_Buffer)))
+      if ((USB_DeviceState == DEVICE_STATE_Configured) &&
+	  VirtualSerial_CDC_Interface.State.LineEncoding.BaudRateBPS)
 	{
-	  int16_t ReceivedByte = CDC_Device_ReceiveByte(&VirtualSerial_CDC_Interface);
-	  
-	  /* Read bytes from the USB OUT endpoint into the USART transmit buffer */
-	  if (!(ReceivedByte < 0))
-	    RingBuffer_Insert(&USBtoUSART_Buffer, ReceivedByte);
-	}
-      
-      /* Check if the UART receive buffer flush timer has expired or the buffer is nearly full */
-      RingBuff_Count_t BufferCount = RingBuffer_GetCount(&USARTtoUSB_Buffer);
-      if ((TIFR0 & (1 << TOV0)) || (BufferCount > BUFFER_NEARLY_FULL))
-	{
-	  TIFR0 |= (1 << TOV0);
-	  
-	  if (USARTtoUSB_Buffer.Count) {
+	  /* Read the CDC OUT bank into the USART transmit buffer, as much as fits in one span */
+	  Endpoint_SelectEndpoint(CDC_RX_EPNUM);
+	  if (Endpoint_IsOUTReceived())
+	    {
+	      RingBuff_Data_t* TxData;
+	      RingBuff_Count_t TxCount = RingBuffer_Reserve(&USBtoUSART_Buffer, &TxData);
+	      uint16_t BankCount = Endpoint_BytesInEndpoint();
+
+	      if (BankCount < TxCount)
+		TxCount = BankCount;
+	      for (RingBuff_Count_t i = 0; i < TxCount; i++)
+		TxData[i] = Endpoint_Read_Byte();
+	      if (BankCount == TxCount)
+		Endpoint_ClearOUT();
+
+	      if (TxCount) {
+		RingBuffer_Publish(&USBtoUSART_Buffer, TxCount);
+		LEDs_TurnOnLEDs(LEDMASK_RX);
+		PulseMSRemaining.RxLEDPulse = TX_RX_LED_PULSE_MS;
+	      }
+	    }
+
+	  /* Write the USART receive buffer into the CDC IN bank a span at a time, sending each bank once full */
+	  RingBuff_Data_t* RxData;
+	  RingBuff_Count_t RxCount = RingBuffer_Peek(&USARTtoUSB_Buffer, &RxData);
+	  RingBuff_Count_t RxUsed = 0;
+
+	  Endpoint_SelectEndpoint(CDC_TX_EPNUM);
+	  while ((RxUsed < RxCount) && Endpoint_IsReadWriteAllowed())
+	    {
+	      Endpoint_Write_Byte(RxData[RxUsed++]);
+	      if (!(Endpoint_IsReadWriteAllowed())) {
+		Endpoint_ClearIN();
+		TxBankFull = true;
+	      }
+	    }
+	  if (RxUsed) {
+	    RingBuffer_Commit(&USARTtoUSB_Buffer, RxUsed);
 	    LEDs_TurnOnLEDs(LEDMASK_TX);
 	    PulseMSRemaining.TxLEDPulse = TX_RX_LED_PULSE_MS;
 	  }
-	  
-	  /* Read bytes from the USART receive buffer into the USB IN endpoint */
-	  while (BufferCount--)
-	    CDC_Device_SendByte(&VirtualSerial_CDC_Interface, RingBuffer_Remove(&USARTtoUSB_Buffer));
-	  
+
+	  /* Send a partly filled bank (or end a transfer of full ones) once per frame */
+	  if (sofFlush) {
+	    sofFlush = FALSE;
+	    if (Endpoint_IsReadWriteAllowed() && (Endpoint_BytesInEndpoint() || TxBankFull)) {
+	      Endpoint_ClearIN();
+	      TxBankFull = false;
+	    }
+	  }
+	}
+
+      /* Send to the USART (the UDRE interrupt drains the buffer at line rate), atomically as a line
+	 encoding request may rewrite UCSR1B from the control endpoint interrupt */
+      if (!(RingBuffer_IsEmpty(&USBtoUSART_Buffer)))
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	  UCSR1B |= (1 << UDRIE1);
+
+      if (TIFR0 & (1 << TOV0))
+	{
+	  TIFR0 |= (1 << TOV0);
+
 	  /* Turn off TX LED(s) once the TX pulse period has elapsed */
 	  if (PulseMSRemaining.TxLEDPulse && !(--PulseMSRemaining.TxLEDPulse))
 	    LEDs_TurnOffLEDs(LEDMASK_TX);
@@ -403,16 +522,7 @@ void processSerial(void) {
 	  if (PulseMSRemaining.RxLEDPulse && !(--PulseMSRemaining.RxLEDPulse))
 	    LEDs_TurnOffLEDs(LEDMASK_RX);
 	}
-      
-      /* Load the next byte from the USART transmit buffer into the USART */
-      if (!(RingBuffer_IsEmpty(&USBtoUSART_Buffer))) {
-	Serial_TxByte(RingBuffer_Remove(&USBtoUSART_Buffer));
-	
-	LEDs_TurnOnLEDs(LEDMASK_RX);
-	PulseMSRemaining.RxLEDPulse = TX_RX_LED_PULSE_MS;
-      }
-		
-      CDC_Device_USBTask(&VirtualSerial_CDC_Interface);
+
       USB_USBTask();
     }
 }
@@ -435,7 +545,7 @@ void SetupHardware(void) {
     systemMode = 1;
     highSpeed = 1;      /* Always at high speed */
     UBRR1L = 0;		/* 1M at 16MHz clock */
-    UCSR1B = (1<<RXEN1) | (1<<TXEN1);
+    UCSR1B = (1<<RXCIE1) | (1<<RXEN1) | (1<<TXEN1);
     PORTB = 0x0E;	/* PORTB1 = HIGH */
   }
 
@@ -466,11 +576,21 @@ void EVENT_USB_Device_ConfigurationChanged(void) {
   if (systemMode == 1) {
     bool ConfigSuccess = true;
     ConfigSuccess &= MIDI_Device_ConfigureEndpoints(&Keyboard_MIDI_Interface);
+    ConfigSuccess &= Endpoint_ConfigureEndpoint(TELEMETRY_IN_EPNUM, EP_TYPE_BULK, ENDPOINT_DIR_IN,
+                                                TELEMETRY_IN_EPSIZE, ENDPOINT_BANK_SINGLE);
+    USB_Device_EnableSOFEvents();
   } else {
     CDC_Device_ConfigureEndpoints(&VirtualSerial_CDC_Interface);
+    USB_Device_EnableSOFEvents();
   }
 }
 
+/** Event handler for the library USB Start of Frame event. */
+void EVENT_USB_Device_StartOfFrame(void) {
+  sofTicks = TCNT0;
+  sofFlush = TRUE;
+}
+
 /** Event handler for the library USB Control Request reception event. */
 void EVENT_USB_Device_ControlRequest(void) {
   if (systemMode == 1) {
@@ -478,11 +598,88 @@ void EVENT_USB_Device_ControlRequest(void) {
   }
 }
 
+/** Processes the vendor control requests of MIDI mode (to the device).
+ *    REQ_SetMidiRoute - wValue: drop mask, wIndex: cable | route << 8 (see MIDI_Route_t).
+ *    REQ_GetMidiRoute - wIndex: cable, returns the MIDI_Route_t.
+ *    REQ_GetStats     - wValue: 1 to clear the counters once read, returns the USB_MCU_Stats_t.
+ *    REQ_GetLatency   - wValue: 1 to clear the statistics once read, returns the USB_MCU_Latency_t.
+ *  A request for a cable that doesn't exist is stalled.
+ */
+static void processVendorRequest(void) {
+  uchar cable = USB_ControlRequest.wIndex & 0xff;
+
+  switch (USB_ControlRequest.bRequest)
+    {
+    case REQ_SetMidiRoute:
+      if (USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_VENDOR | REQREC_DEVICE))
+	{
+	  uchar route = USB_ControlRequest.wIndex >> 8;
+
+	  if ((cable >= MIDI_OUT_CABLES) ||
+	      ((route & MIDI_ROUTE_LOOPBACK) && ((route >> 4) >= MIDI_IN_CABLES)))
+	    break;
+	  Endpoint_ClearSETUP();
+	  midiRoutes[cable].Drop = USB_ControlRequest.wValue;
+	  midiRoutes[cable].Route = route;
+	  Endpoint_ClearStatusStage();
+	}
+      break;
+    case REQ_GetMidiRoute:
+      if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_VENDOR | REQREC_DEVICE))
+	{
+	  if (cable >= MIDI_OUT_CABLES)
+	    break;
+	  Endpoint_ClearSETUP();
+	  Endpoint_Write_Control_Stream_LE(&midiRoutes[cable], sizeof(MIDI_Route_t));
+	  Endpoint_ClearOUT();
+	}
+      break;
+    case REQ_GetStats:
+      if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_VENDOR | REQREC_DEVICE))
+	{
+	  USB_MCU_Stats_t Report;
+
+	  /* The serial ISR updates the counters while this runs (with interrupts enabled). */
+	  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	    {
+	      Report = Stats;
+	      Report.TelemetryLost = midiTelemetryLost;
+	      if (USB_ControlRequest.wValue & 1) {
+		memset(&Stats, 0, sizeof(Stats));
+		midiTelemetryLost = 0;
+	      }
+	    }
+	  Endpoint_ClearSETUP();
+	  Endpoint_Write_Control_Stream_LE(&Report, sizeof(USB_MCU_Stats_t));
+	  Endpoint_ClearOUT();
+	}
+      break;
+    case REQ_GetLatency:
+      if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_VENDOR | REQREC_DEVICE))
+	{
+	  USB_MCU_Latency_t Report;
+
+	  /* The main loop updates the statistics with interrupts masked, so they are copied whole. */
+	  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	    {
+	      Report = Latency;
+	      if (USB_ControlRequest.wValue & 1)
+		memset(&Latency, 0, sizeof(Latency));
+	    }
+	  Endpoint_ClearSETUP();
+	  Endpoint_Write_Control_Stream_LE(&Report, sizeof(USB_MCU_Latency_t));
+	  Endpoint_ClearOUT();
+	}
+      break;
+    }
+}
+
 /** Event handler for the library USB Unhandled Control Request event. */
 void EVENT_USB_Device_UnhandledControlRequest(void) {
   if (systemMode == 0) {
     CDC_Device_ProcessControlRequest(&VirtualSerial_CDC_Interface);
   } else {
+    processVendorRequest();
     MIDI_Device_ProcessControlRequest(&Keyboard_MIDI_Interface);
   }
 }
@@ -492,8 +689,14 @@ void EVENT_USB_Device_UnhandledControlRequest(void) {
  *  \param[in] CDCInterfaceInfo  Pointer to the CDC class interface configuration structure being referenced
  */
 void EVENT_CDC_Device_LineEncodingChanged(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo) {
+  uint32_t BaudRateBPS = CDCInterfaceInfo->State.LineEncoding.BaudRateBPS;
+  uint32_t Divisor;
+  bool DoubleSpeed;
   uint8_t ConfigMask = 0;
 
+  if (!BaudRateBPS)
+    return;
+
   switch (CDCInterfaceInfo->State.LineEncoding.ParityType)
     {
     case CDC_PARITY_Odd:
@@ -525,27 +728,57 @@ void EVENT_CDC_Device_LineEncodingChanged(USB_ClassInfo_CDC_Device_t* const CDCI
   UCSR1A = 0;
   UCSR1C = 0;
 
-  /* Special case 57600 baud for compatibility with the ATmega328 bootloader. */	
-  UBRR1  = (CDCInterfaceInfo->State.LineEncoding.BaudRateBPS == 57600)
-    ? SERIAL_UBBRVAL(CDCInterfaceInfo->State.LineEncoding.BaudRateBPS)
-    : SERIAL_2X_UBBRVAL(CDCInterfaceInfo->State.LineEncoding.BaudRateBPS);	
+  /* Double speed mode, which gives the rates that divide 2M exactly (250k, 500k, 1M, 2M) at 16MHz, unless
+     the divisor doesn't fit in UBRR1.  Special case 57600 baud for compatibility with the ATmega328
+     bootloader. */
+  if (BaudRateBPS > (F_CPU / 8))
+    BaudRateBPS = F_CPU / 8;
+  Divisor = SERIAL_2X_UBBRVAL(BaudRateBPS);
+  DoubleSpeed = (BaudRateBPS != 57600) && (Divisor <= UBRR_MAX);
+  if (!DoubleSpeed)
+    Divisor = SERIAL_UBBRVAL(BaudRateBPS);
+  UBRR1  = (Divisor > UBRR_MAX) ? UBRR_MAX : Divisor;
 
   UCSR1C = ConfigMask;
-  UCSR1A = (CDCInterfaceInfo->State.LineEncoding.BaudRateBPS == 57600) ? 0 : (1 << U2X1);
+  UCSR1A = DoubleSpeed ? (1 << U2X1) : 0;
   UCSR1B = ((1 << RXCIE1) | (1 << TXEN1) | (1 << RXEN1));
 }
 
 /** ISR to manage the reception of data from the serial port, placing received bytes into a circular buffer
- *  for later transmission to the host.
+ *  for later transmission to the host.  A byte that arrives while the buffer is full is dropped.
  */
 ISR(USART1_RX_vect, ISR_BLOCK) {
+  uint8_t Status = UCSR1A;
   uint8_t ReceivedByte = UDR1;
 
+  if (Status & ((1 << FE1) | (1 << DOR1)))
+    Stats.LinkRxErrors++;
   if (USB_DeviceState == DEVICE_STATE_Configured) {
-    RingBuffer_Insert(&USARTtoUSB_Buffer, ReceivedByte);
+    if (RingBuffer_IsFull(&USARTtoUSB_Buffer)) {
+      Stats.LinkRxLost++;
+    } else {
+      if ((Probe.State == PROBE_IDLE) && (systemMode == 1)) {
+	/* Time this one (see USB_MCU_Latency_t). */
+	Probe.Index = USARTtoUSB_Buffer.In;
+	latencyNow((LatencyTime_t *)&Probe.Start);
+	Probe.State = PROBE_ARMED;
+      }
+      RingBuffer_Insert(&USARTtoUSB_Buffer, ReceivedByte);
+    }
   }
 }
 
+/** ISR to feed the serial port from the circular buffer of data from the host.  The
+ *  interrupt is enabled by the main loop when it queues data, and disables itself once the buffer
+ *  is empty.
+ */
+ISR(USART1_UDRE_vect, ISR_BLOCK) {
+  if (!(RingBuffer_IsEmpty(&USBtoUSART_Buffer)))
+    UDR1 = RingBuffer_Remove(&USBtoUSART_Buffer);
+  else
+    UCSR1B &= ~(1<<UDRIE1);
+}
+
 /** Event handler for the CDC Class driver Host-to-Device Line Encoding Changed event.
  *
  *  \param[in] CDCInterfaceInfo  Pointer to the CDC class interface configuration structure being referenced
@@ -12,9 +12,11 @@
      Serial USB-MIDI multiplexed using 0xFD as a MIDI-escape sequence.
      0xFD, 0x00 | (0x0f & port_cable_id) - to change the port MIDI stream.
      0xFD, 0xFD - to insert the 0xFD byte (undefined / unused MIDI status code).
+     0xFD, (units << 4) | (0x0f & port_cable_id) - credit of units * 4 bytes for a cable from the host (from the main MCU).
      0xFD, [any other value] - both the 0xFD and the escaped byte are discarded.
 
-     MIDI router (details to be added).
+     MIDI router - each cable from the host can drop message types, be forwarded to the main MCU,
+     and / or be looped back to a cable to the host (see REQ_SetMidiRoute).
 
      Derived from dualMocoLUFA serial / USB-MIDI project
      Derived from USB-MIDI interface LUFA Library project template.
@@ -74,6 +76,7 @@
 		#include <avr/wdt.h>
 		#include <avr/interrupt.h>
 		#include <avr/power.h>
+		#include <util/atomic.h>
 
 		#include "Descriptors.h"
 
@@ -98,13 +101,73 @@
 		/** LED mask for the library LED driver, to indicate that the USB interface is busy. */
 		#define LEDMASK_BUSY             (LEDS_LED1 | LEDS_LED2)		
 		
+		/** Vendor control requests of MIDI mode (see processVendorRequest()). */
+		#define REQ_SetMidiRoute         0x01
+		#define REQ_GetMidiRoute         0x02
+		#define REQ_GetStats             0x03
+		#define REQ_GetLatency           0x04
+
+		/** Number of bins of the latency histogram (\ref USB_MCU_Latency_t). */
+		#define LATENCY_BINS             8
+		/** The first latency bin holds delays below 64us, each following one doubles the upper bound. */
+		#define LATENCY_BIN0_SHIFT       6
+
 		typedef uint8_t uchar;
-		#define HW_CDC_BULK_OUT_SIZE     8
-		#define HW_CDC_BULK_IN_SIZE      8
+
+		/** Size of the serial link buffers - each a power of two, up to 256. */
+		#ifndef USB_TO_USART_BUFFER_SIZE
+			#define USB_TO_USART_BUFFER_SIZE 128
+		#endif
+		#ifndef USART_TO_USB_BUFFER_SIZE
+			#define USART_TO_USB_BUFFER_SIZE 128
+		#endif
+
+		/** Size of the buffer of telemetry from the Main MCU to its IN endpoint - a power of two, up to 256. */
+		#ifndef TELEMETRY_BUFFER_SIZE
+			#define TELEMETRY_BUFFER_SIZE    32
+		#endif
+
+		/** Largest USART baud rate divisor (UBRR1 is 12 bits). */
+		#define UBRR_MAX                 4095
 
 		#define	TRUE			1
 		#define	FALSE			0
 
+	/* Type Defines: */
+		/** Health counters of the USB MCU (MIDI mode), read by REQ_GetStats. */
+		typedef struct
+		{
+			uint16_t LinkRxLost;     /**< Bytes from the Main MCU lost, as the buffer to the host was full. */
+			uint16_t LinkRxErrors;   /**< Framing and overrun errors of the serial link. */
+			uint16_t TelemetryLost;  /**< Telemetry bytes lost, as the telemetry buffer was full. */
+			uint8_t  USARTtoUSBHigh; /**< Most bytes held in the buffer to the host. */
+			uint8_t  USBtoUSARTHigh; /**< Most bytes held in the buffer to the Main MCU. */
+			uint8_t  LoopMax;        /**< Longest pass of the main loop, in 16us ticks of timer 0. */
+		} USB_MCU_Stats_t;
+
+		/** Latency of the events to the host (MIDI mode), read by REQ_GetLatency.  One byte from the Main
+		 *  MCU at a time is timed, from its arrival to the MIDI IN bank holding the event that it completes
+		 *  being sent (a byte that is no part of an event, such as telemetry or an escape, is passed
+		 *  over).  Counts are halved together when one of them would wrap.
+		 */
+		typedef struct
+		{
+			uint16_t Samples;            /**< Events timed. */
+			uint16_t Bins[LATENCY_BINS]; /**< Histogram of their delays to the bank being sent. */
+			uint16_t QueueMax;           /**< Longest delay to the IN bank (us, 0xffff for 65ms or more). */
+			uint16_t SendMax;            /**< Longest delay to the IN bank being sent (us, likewise). */
+			uint16_t Frames;             /**< Frames with events to the host. */
+			uint16_t Events;             /**< Events to the host in those frames. */
+			uint8_t  FrameEventsMax;     /**< Most events to the host in one frame. */
+		} USB_MCU_Latency_t;
+
+		/** A point in time - the USB frame number, and 16us ticks of timer 0 since that frame started. */
+		typedef struct
+		{
+			uint16_t Frame;
+			uint8_t  Ticks;
+		} LatencyTime_t;
+
 	/* Function Prototypes: */
 		void SetupHardware(void);
 		void processSerial(void);
@@ -113,13 +176,12 @@
 		void EVENT_USB_Device_Connect(void);
 		void EVENT_USB_Device_Disconnect(void);
 		void EVENT_USB_Device_ConfigurationChanged(void);
+		void EVENT_USB_Device_StartOfFrame(void);
 		void EVENT_USB_Device_UnhandledControlRequest(void);
 		
 		void EVENT_CDC_Device_LineEncodingChanged(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo);
 		void EVENT_CDC_Device_ControLineStateChanged(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo);		
 
-		uchar parseSerialMidiMessage(uchar);
-		void parseUSBMidiMessage(uchar *);
 	/* shared variable */
 		extern uchar systemMode;
 